@@ -0,0 +1,276 @@
+// Allocation accounting, an opt-in build mode for all of the programs.
+//
+// Built with ALLOCATION_ACCOUNTING defined (g++ -DALLOCATION_ACCOUNTING ...),
+// a program replaces the global operator new so that each allocation, and
+// its size, is counted against the innermost ALLOCATION_SCOPE the
+// allocating thread is in, or against "(outside scopes)".  When the program
+// exits, it writes a table of the counts for each scope to standard error.
+//
+// A scope is usually a whole public function.  A by-value parameter is
+// copied by the caller before the function starts, so the copy counts
+// against the caller's scope.  threadAllocationCounts counts every
+// allocation of the calling thread, so taking it before and after a call
+// catches everything the call costs; the benchmark suite uses it to check
+// allocation budgets.
+//
+// Without ALLOCATION_ACCOUNTING, ALLOCATION_SCOPE expands to nothing and
+// the allocator is left alone.
+//
+// This header defines the replacement operator new and delete, so a program
+// must include it in just one translation unit (each of these programs is
+// one), and at file scope:  a program that includes another inside a
+// namespace includes this header first.
+
+#ifndef ALLOCATION_ACCOUNTING_H
+#define ALLOCATION_ACCOUNTING_H
+
+#ifdef ALLOCATION_ACCOUNTING
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+struct AllocationCounts
+{
+	long long count;
+	long long bytes;
+};
+
+// The counts for one scope.  A region is constant-initialized, so it can
+// count allocations made before main, and it puts itself on the list the
+// report walks the first time it's entered.
+class AllocationRegion
+{
+public:
+	constexpr AllocationRegion(const char* name)
+		: m_name(name), m_entries(0), m_count(0), m_bytes(0),
+		m_registered(false), m_next(nullptr)
+	{
+	}
+
+	const char* name() const { return m_name; }
+	long long entries() const { return m_entries.load(std::memory_order_relaxed); }
+	AllocationCounts counts() const
+	{
+		AllocationCounts c = { m_count.load(std::memory_order_relaxed),
+			m_bytes.load(std::memory_order_relaxed) };
+		return c;
+	}
+	AllocationRegion* next() const { return m_next; }
+
+	void enter()
+	{
+		m_entries.fetch_add(1, std::memory_order_relaxed);
+		addToList();
+	}
+	void addToList();
+	void add(std::size_t bytes)
+	{
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	// The regions entered so far, most recent first
+	static AllocationRegion* first() { return s_first.load(std::memory_order_acquire); }
+
+private:
+	const char*             m_name;
+	std::atomic<long long>  m_entries;
+	std::atomic<long long>  m_count;
+	std::atomic<long long>  m_bytes;
+	std::atomic<bool>       m_registered;
+	AllocationRegion*       m_next;
+
+	static inline std::atomic<AllocationRegion*> s_first{nullptr};
+};
+
+inline AllocationRegion outsideAllocationScopes("(outside scopes)");
+inline thread_local AllocationRegion* currentAllocationRegion = nullptr;
+inline thread_local AllocationCounts threadAllocations = { 0, 0 };
+
+inline void AllocationRegion::addToList()
+{
+	if (m_registered.load(std::memory_order_relaxed) || m_registered.exchange(true))
+		return;
+	AllocationRegion* head = s_first.load(std::memory_order_relaxed);
+	do
+		m_next = head;
+	while (!s_first.compare_exchange_weak(head, this, std::memory_order_release,
+		std::memory_order_relaxed));
+}
+
+// Counts allocations against region for the rest of the block it's
+// declared in
+class AllocationScope
+{
+public:
+	AllocationScope(AllocationRegion& region)
+		: m_outer(currentAllocationRegion)
+	{
+		region.enter();
+		currentAllocationRegion = &region;
+	}
+	~AllocationScope() { currentAllocationRegion = m_outer; }
+
+private:
+	AllocationScope(const AllocationScope&) = delete;
+	AllocationScope& operator=(const AllocationScope&) = delete;
+
+	AllocationRegion* m_outer;
+};
+
+#define ALLOCATION_SCOPE(name) \
+	static AllocationRegion allocationRegion(name); \
+	AllocationScope allocationScope(allocationRegion)
+
+inline void recordAllocation(std::size_t bytes)
+{
+	AllocationRegion* region = currentAllocationRegion;
+	(region != nullptr ? region : &outsideAllocationScopes)->add(bytes);
+	threadAllocations.count++;
+	threadAllocations.bytes += bytes;
+}
+
+// Every allocation the calling thread has made
+inline AllocationCounts threadAllocationCounts()
+{
+	return threadAllocations;
+}
+
+// The allocations counted against every scope of the given name (all
+// threads), or zeros if no such scope has been entered
+inline AllocationCounts regionAllocationCounts(const char* name)
+{
+	AllocationCounts total = { 0, 0 };
+	for (AllocationRegion* r = AllocationRegion::first(); r != nullptr; r = r->next())
+	{
+		if (std::strcmp(r->name(), name) == 0)
+		{
+			total.count += r->counts().count;
+			total.bytes += r->counts().bytes;
+		}
+	}
+	return total;
+}
+
+// Write one line per scope that allocated, most bytes first.  The report
+// itself allocates nothing.
+inline void writeAllocationReport(std::FILE* out)
+{
+	const int MAX_REPORTED = 1000;
+	AllocationRegion* regions[MAX_REPORTED];
+	int n = 0;
+	outsideAllocationScopes.addToList();
+	for (AllocationRegion* r = AllocationRegion::first();
+			r != nullptr && n < MAX_REPORTED; r = r->next())
+	{
+		if (r->counts().count == 0)
+			continue;
+		int k = n++;
+		for ( ; k > 0 && regions[k - 1]->counts().bytes < r->counts().bytes; k--)
+			regions[k] = regions[k - 1];
+		regions[k] = r;
+	}
+
+	std::fprintf(out, "%-32s %12s %12s %14s %10s\n", "scope", "entries",
+		"allocations", "bytes", "per entry");
+	for (int k = 0; k < n; k++)
+	{
+		AllocationCounts c = regions[k]->counts();
+		long long entries = regions[k]->entries();
+		std::fprintf(out, "%-32s %12lld %12lld %14lld", regions[k]->name(),
+			entries, c.count, c.bytes);
+		if (entries > 0)
+			std::fprintf(out, " %10.2f\n", double(c.count) / entries);
+		else
+			std::fprintf(out, " %10s\n", "-");
+	}
+}
+
+struct AllocationReportAtExit
+{
+	~AllocationReportAtExit()
+	{
+		std::fflush(stdout);  // so the report follows the program's output
+		writeAllocationReport(stderr);
+	}
+};
+
+inline AllocationReportAtExit allocationReportAtExit;
+
+// The replacements.  The array and nothrow forms of new and delete are
+// defined by the standard to call these, so they're counted too.  The sized
+// forms of delete are replaced as well, forwarding to the unsized ones, so
+// that memory is always freed the way it was allocated.  The deletes are
+// kept out of line:  otherwise g++ inlines them where the library frees a
+// block it got from operator new, sees free called on it, and warns
+// (-Wmismatched-new-delete).
+
+#if defined(__GNUC__)
+#define ALLOCATION_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define ALLOCATION_NOINLINE __declspec(noinline)
+#else
+#define ALLOCATION_NOINLINE
+#endif
+
+void* operator new(std::size_t size)
+{
+	recordAllocation(size);
+	void* p = std::malloc(size == 0 ? 1 : size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	recordAllocation(size);
+	std::size_t a = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+	void* p = _aligned_malloc(size == 0 ? 1 : size, a);
+#else
+	void* p = nullptr;
+	if (posix_memalign(&p, a < sizeof(void*) ? sizeof(void*) : a,
+			size == 0 ? 1 : size) != 0)
+		p = nullptr;
+#endif
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+ALLOCATION_NOINLINE void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+ALLOCATION_NOINLINE void operator delete(void* p, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+ALLOCATION_NOINLINE void operator delete(void* p, std::size_t) noexcept
+{
+	operator delete(p);
+}
+
+ALLOCATION_NOINLINE void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+#else
+
+#define ALLOCATION_SCOPE(name)
+
+#endif
+
+#endif  // ALLOCATION_ACCOUNTING_H
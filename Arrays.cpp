@@ -1,9 +1,11 @@
 #include <string>
+#include "Allocation Accounting.h"
 
 using namespace std;
 
 void exchange(string& s1, string& s2)
 {
+	ALLOCATION_SCOPE("exchange");
 	string t = s1;
 	s1 = s2;
 	s2 = t;
@@ -11,6 +13,7 @@ void exchange(string& s1, string& s2)
 
 int appendToAll(string a[], int n, string value)
 {
+	ALLOCATION_SCOPE("appendToAll");
 	if (n < 0)
 		return -1;
 	for (int k = 0; k < n; k++)
@@ -20,6 +23,7 @@ int appendToAll(string a[], int n, string value)
 
 int lookup(const string a[], int n, string target)
 {
+	ALLOCATION_SCOPE("lookup");
 	if (n < 0)
 		return -1;
 	for (int k = 0; k < n; k++)
@@ -30,6 +34,7 @@ int lookup(const string a[], int n, string target)
 
 int positionOfMax(const string a[], int n)
 {
+	ALLOCATION_SCOPE("positionOfMax");
 	if (n <= 0)
 		return -1;
 	int maxPos = 0;  //  assume to start that the max is at position 0
@@ -41,6 +46,7 @@ int positionOfMax(const string a[], int n)
 
 int rotateLeft(string a[], int n, int pos)
 {
+	ALLOCATION_SCOPE("rotateLeft");
 	if (n < 0 || pos < 0 || pos >= n)
 		return -1;
 
@@ -58,6 +64,7 @@ int rotateLeft(string a[], int n, int pos)
 
 int rotateRight(string a[], int n, int pos)
 {
+	ALLOCATION_SCOPE("rotateRight");
 	if (n < 0 || pos < 0 || pos >= n)
 		return -1;
 
@@ -75,6 +82,7 @@ int rotateRight(string a[], int n, int pos)
 
 int flip(string a[], int n)
 {
+	ALLOCATION_SCOPE("flip");
 	if (n < 0)
 		return -1;
 	// exchange elements at positions 0 and n-1, then 1 and n-2, then 2 and
@@ -86,6 +94,7 @@ int flip(string a[], int n)
 
 int differ(const string a1[], int n1, const string a2[], int n2)
 {
+	ALLOCATION_SCOPE("differ");
 	if (n1 < 0 || n2 < 0)
 		return -1;
 	int n = (n1 < n2 ? n1 : n2);  // minimum of n1 and n2
@@ -97,6 +106,7 @@ int differ(const string a1[], int n1, const string a2[], int n2)
 
 int subsequence(const string a1[], int n1, const string a2[], int n2)
 {
+	ALLOCATION_SCOPE("subsequence");
 	if (n1 < 0 || n2 < 0)
 		return -1;
 
@@ -124,6 +134,7 @@ int subsequence(const string a1[], int n1, const string a2[], int n2)
 
 int lookupAny(const string a1[], int n1, const string a2[], int n2)
 {
+	ALLOCATION_SCOPE("lookupAny");
 	if (n1 < 0 || n2 < 0)
 		return -1;
 	for (int k = 0; k < n1; k++)
@@ -134,6 +145,7 @@ int lookupAny(const string a1[], int n1, const string a2[], int n2)
 
 int separate(string a[], int n, string separator)
 {
+	ALLOCATION_SCOPE("separate");
 	if (n < 0)
 		return -1;
 
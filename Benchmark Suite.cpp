@@ -0,0 +1,1133 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+// One program that times the functions of all five programs on inputs
+// generated from fixed seeds and writes the results as JSON.  With
+// --compare=FILE, it also reports each result against the one of the same
+// name in FILE (a saved run) and fails if any is more than --threshold
+// percent slower.  Along with the timings, it checks that the fast paths
+// of Word Finder compute the same results as simpler references, and fails
+// if any doesn't.
+//
+// Build from this directory with
+//   g++ -std=c++17 -O2 -pthread -o benchmark "Benchmark Suite.cpp"
+
+// Every header the programs include is included here first, so that
+// including the programs inside namespaces below (which keeps, say, the two
+// mains apart) doesn't put the library inside those namespaces too.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <cmath>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <conio.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#endif
+#include "Allocation Accounting.h"
+#include "Options.h"
+
+namespace arrays
+{
+#include "Arrays.cpp"
+}
+namespace phonebill
+{
+#include "Phone Bill Calculator.cpp"
+}
+namespace piano
+{
+#include "Piano Note Converter.cpp"
+}
+namespace wordfinder
+{
+#include "Word Finder.cpp"
+}
+namespace snake
+{
+#include "Snake Game.cpp"
+}
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////
+//  Running and recording benchmarks
+///////////////////////////////////////////////////////////////////////////
+
+struct BenchmarkResult
+{
+	string    name;
+	double    nsPerOp;  // median of the samples
+	double    minNsPerOp;
+	long long ops;      // operations timed in each sample
+
+	// Allocated by one run, if built with ALLOCATION_ACCOUNTING, or -1
+	long long allocationsPerRun;
+	long long bytesPerRun;
+};
+
+// Results are kept in this, so the optimizer can't drop the work whose
+// results it would otherwise see are unused.
+volatile long long benchmarkSink;
+
+class BenchmarkSuite
+{
+public:
+	BenchmarkSuite(string filter, double sampleSeconds);
+	bool selected(string name) const;
+
+	// Whether any of the names is selected, so that a group of benchmarks
+	// can skip building inputs none of them would use
+	bool anySelected(const vector<string>& names) const;
+
+	// Time run, which does opsPerRun operations each call: it is called
+	// often enough that each of N_SAMPLES samples takes about the sample
+	// time, and the median time per operation is recorded under name.
+	template<typename Run>
+	void measure(string name, long long opsPerRun, Run run);
+
+	// Run check, which compares a fast way of computing something with a
+	// reference and returns whether they agree, setting detail to a line
+	// about what it found.  A failed check makes the run fail.
+	template<typename Check>
+	void check(string name, Check run);
+
+	const vector<BenchmarkResult>& results() const { return m_results; }
+	int failedCheckCount() const { return m_nFailedChecks; }
+	bool writeJson(ostream& out) const;
+
+	static const int N_SAMPLES = 5;
+
+private:
+	string                  m_filter;
+	double                  m_sampleSeconds;
+	vector<BenchmarkResult> m_results;
+	int                     m_nFailedChecks;
+};
+
+BenchmarkSuite::BenchmarkSuite(string filter, double sampleSeconds)
+	: m_filter(filter), m_sampleSeconds(sampleSeconds), m_nFailedChecks(0)
+{
+}
+
+bool BenchmarkSuite::selected(string name) const
+{
+	return name.find(m_filter) != string::npos;
+}
+
+bool BenchmarkSuite::anySelected(const vector<string>& names) const
+{
+	for (const string& name : names)
+		if (selected(name))
+			return true;
+	return false;
+}
+
+template<typename Check>
+void BenchmarkSuite::check(string name, Check run)
+{
+	if (!selected(name))
+		return;
+	string detail;
+	if (run(detail))
+		cerr << name << ": " << detail << endl;
+	else
+	{
+		cout << name << ": " << detail << "  CHECK FAILED" << endl;
+		m_nFailedChecks++;
+	}
+}
+
+template<typename Run>
+void BenchmarkSuite::measure(string name, long long opsPerRun, Run run)
+{
+	if (!selected(name))
+		return;
+
+	// Double the calls per sample until a sample takes a tenth of the
+	// sample time, then scale up to the whole sample time.
+	long long calls = 1;
+	for (;;)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (long long k = 0; k < calls; k++)
+			benchmarkSink = benchmarkSink + run();
+		double seconds = chrono::duration<double>(
+			chrono::steady_clock::now() - start).count();
+		if (seconds >= m_sampleSeconds / 10)
+		{
+			calls = max(1LL, (long long)(calls * m_sampleSeconds / seconds));
+			break;
+		}
+		calls *= 2;
+	}
+
+	vector<double> samples;
+	for (int s = 0; s < N_SAMPLES; s++)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (long long k = 0; k < calls; k++)
+			benchmarkSink = benchmarkSink + run();
+		double ns = chrono::duration<double, nano>(
+			chrono::steady_clock::now() - start).count();
+		samples.push_back(ns / (calls * opsPerRun));
+	}
+	sort(samples.begin(), samples.end());
+
+	BenchmarkResult result = { name, samples[N_SAMPLES / 2], samples[0],
+		calls * opsPerRun, -1, -1 };
+#ifdef ALLOCATION_ACCOUNTING
+	// One more run, counting what it allocates
+	AllocationCounts before = threadAllocationCounts();
+	benchmarkSink = benchmarkSink + run();
+	AllocationCounts after = threadAllocationCounts();
+	result.allocationsPerRun = after.count - before.count;
+	result.bytesPerRun = after.bytes - before.bytes;
+#endif
+	m_results.push_back(result);
+	cerr << name << ": " << result.nsPerOp << " ns per op" << endl;
+}
+
+bool BenchmarkSuite::writeJson(ostream& out) const
+{
+	out << "{\n  \"benchmarks\": [";
+	for (size_t k = 0; k < m_results.size(); k++)
+	{
+		const BenchmarkResult& r = m_results[k];
+		out << (k == 0 ? "\n" : ",\n") << "    {\"name\": \"" << r.name
+			<< "\", \"ns_per_op\": " << r.nsPerOp << ", \"min_ns_per_op\": "
+			<< r.minNsPerOp << ", \"ops\": " << r.ops;
+		if (r.allocationsPerRun >= 0)
+			out << ", \"allocations_per_run\": " << r.allocationsPerRun
+				<< ", \"bytes_per_run\": " << r.bytesPerRun;
+		out << "}";
+	}
+	out << "\n  ]\n}\n";
+	return bool(out);
+}
+
+// Read the name and ns_per_op of each result in a file written by
+// writeJson, returning false if the file can't be read.  This is not a
+// general JSON reader: it only finds the fields writeJson writes.
+bool readBaseline(string path, map<string, double>& nsPerOp)
+{
+	ifstream in(path);
+	if (!in)
+		return false;
+	string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	const string NAME = "\"name\": \"";
+	const string NS = "\"ns_per_op\": ";
+	size_t pos = 0;
+	while ((pos = text.find(NAME, pos)) != string::npos)
+	{
+		pos += NAME.size();
+		size_t end = text.find('"', pos);
+		size_t ns = text.find(NS, end);
+		if (end == string::npos || ns == string::npos)
+			return false;
+		nsPerOp[text.substr(pos, end - pos)] =
+			strtod(text.c_str() + ns + NS.size(), nullptr);
+		pos = ns;
+	}
+	return true;
+}
+
+// Report each result against the baseline, returning the number more than
+// thresholdPercent slower.
+int compareWithBaseline(const vector<BenchmarkResult>& results,
+	const map<string, double>& baseline, double thresholdPercent)
+{
+	int nRegressions = 0;
+	cout.setf(ios::fixed);
+	cout.precision(1);
+	for (const BenchmarkResult& r : results)
+	{
+		map<string, double>::const_iterator b = baseline.find(r.name);
+		if (b == baseline.end())
+		{
+			cout << r.name << ": " << r.nsPerOp << " ns (not in baseline)" << endl;
+			continue;
+		}
+		double change = (r.nsPerOp / b->second - 1) * 100;
+		cout << r.name << ": " << b->second << " -> " << r.nsPerOp << " ns ("
+			<< (change >= 0 ? "+" : "") << change << "%)";
+		if (change > thresholdPercent)
+		{
+			cout << "  REGRESSION";
+			nRegressions++;
+		}
+		cout << endl;
+	}
+	cout << nRegressions << " of " << results.size()
+		<< " benchmarks regressed by more than " << thresholdPercent << "%"
+		<< endl;
+	return nRegressions;
+}
+
+// The most allocations one run of a benchmark may make, for benchmarks
+// whose names start with prefix.  The budgets are checked only when built
+// with ALLOCATION_ACCOUNTING; a run of lookup, say, copies its by-value
+// target, which allocates when the strings are too long to be stored
+// inside the string object.
+struct AllocationBudget
+{
+	const char* prefix;
+	long long   maxAllocations;
+};
+
+const AllocationBudget ALLOCATION_BUDGETS[] = {
+	{ "arrays/lookup/", 1 },
+	{ "arrays/positionOfMax/", 0 },
+	{ "arrays/differ/", 0 },
+	{ "arrays/subsequence/", 0 },
+	{ "phonebill/", 0 },
+	{ "piano/isTuneWellFormed/", 1 },
+	{ "snake/moveSnakes/", 0 },
+};
+
+// Report each result over its budget, returning the number that are.
+int checkAllocationBudgets(const vector<BenchmarkResult>& results)
+{
+	int nOver = 0;
+	for (const BenchmarkResult& r : results)
+	{
+		for (const AllocationBudget& budget : ALLOCATION_BUDGETS)
+		{
+			if (r.allocationsPerRun < 0 || r.name.compare(0, strlen(budget.prefix),
+					budget.prefix) != 0 || r.allocationsPerRun <= budget.maxAllocations)
+				continue;
+			cout << r.name << ": " << r.allocationsPerRun
+				<< " allocations per run, budget " << budget.maxAllocations
+				<< "  OVER BUDGET" << endl;
+			nOver++;
+		}
+	}
+	return nOver;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Benchmarks
+///////////////////////////////////////////////////////////////////////////
+
+// n strings of the given length that differ only in their last four
+// characters, so comparing two of them looks at every character
+vector<string> makeStrings(mt19937& gen, int n, int length)
+{
+	uniform_int_distribution<int> letter('a', 'z');
+	vector<string> a(n, string(length - 4, 'x'));
+	for (string& s : a)
+		for (int k = 0; k < 4; k++)
+			s += char(letter(gen));
+	return a;
+}
+
+void benchmarkArrays(BenchmarkSuite& suite)
+{
+	const int SIZES[] = { 16, 1024, 65536 };
+	const int LENGTHS[] = { 8, 64 };
+	for (int n : SIZES)
+	{
+		for (int length : LENGTHS)
+		{
+			mt19937 gen(n * 100 + length);
+			vector<string> a = makeStrings(gen, n, length);
+			vector<string> b = a;
+			vector<string> tail(a.end() - min(n, 8), a.end());
+			vector<string> absent = makeStrings(gen, 4, length);
+			for (string& s : absent)
+				s[0] = 'y';
+			string separator = a[n / 2];
+			string suffix = "/" + to_string(n) + "/" + to_string(length);
+
+			// Targets are absent and arrays equal, so each call looks at
+			// all n strings.
+			suite.measure("arrays/lookup" + suffix, n, [&] {
+				return arrays::lookup(a.data(), n, absent[0]);
+			});
+			suite.measure("arrays/positionOfMax" + suffix, n, [&] {
+				return arrays::positionOfMax(a.data(), n);
+			});
+			suite.measure("arrays/rotateLeft" + suffix, n, [&] {
+				return arrays::rotateLeft(b.data(), n, 0);
+			});
+			suite.measure("arrays/rotateRight" + suffix, n, [&] {
+				return arrays::rotateRight(b.data(), n, n - 1);
+			});
+			suite.measure("arrays/flip" + suffix, n, [&] {
+				return arrays::flip(b.data(), n);
+			});
+			suite.measure("arrays/differ" + suffix, n, [&] {
+				return arrays::differ(a.data(), n, a.data(), n);
+			});
+			suite.measure("arrays/subsequence" + suffix, n, [&] {
+				return arrays::subsequence(a.data(), n, tail.data(), tail.size());
+			});
+			suite.measure("arrays/lookupAny" + suffix, n, [&] {
+				return arrays::lookupAny(a.data(), n, absent.data(), absent.size());
+			});
+			suite.measure("arrays/separate" + suffix, n, [&] {
+				return arrays::separate(b.data(), n, separator);
+			});
+		}
+	}
+}
+
+struct UsageRecord
+{
+	int minutes;
+	int texts;
+	int month;
+};
+
+void benchmarkPhoneBill(BenchmarkSuite& suite)
+{
+	const int N_RECORDS = 10000;
+	mt19937 gen(2);
+	uniform_int_distribution<int> minutes(0, 1000);
+	uniform_int_distribution<int> texts(0, 600);
+	uniform_int_distribution<int> month(1, 12);
+	vector<UsageRecord> records;
+	for (int k = 0; k < N_RECORDS; k++)
+	{
+		UsageRecord r = { minutes(gen), texts(gen), month(gen) };
+		records.push_back(r);
+	}
+
+	suite.measure("phonebill/computeBill", N_RECORDS, [&] {
+		double total = 0;
+		for (const UsageRecord& r : records)
+			total += phonebill::computeBill(r.minutes, r.texts, r.month);
+		return (long long)total;
+	});
+}
+
+// A well-formed tune of nBeats beats, each of zero to three notes, in
+// octaves 2 through 5 (so all playable) or with the default octave
+string makeTune(mt19937& gen, int nBeats)
+{
+	uniform_int_distribution<int> notes(0, 3);
+	uniform_int_distribution<int> letter(0, 6);
+	uniform_int_distribution<int> accidental(0, 3);
+	uniform_int_distribution<int> octave(1, 5);
+	string tune;
+	for (int b = 0; b < nBeats; b++)
+	{
+		for (int n = notes(gen); n > 0; n--)
+		{
+			tune += char('A' + letter(gen));
+			int a = accidental(gen);
+			if (a < 2)
+				tune += "#b"[a];
+			int o = octave(gen);
+			if (o > 1)
+				tune += char('0' + o);
+		}
+		tune += '/';
+	}
+	return tune;
+}
+
+void benchmarkPiano(BenchmarkSuite& suite)
+{
+	const int BEATS[] = { 16, 1024 };
+	for (int nBeats : BEATS)
+	{
+		mt19937 gen(3 + nBeats);
+		string tune = makeTune(gen, nBeats);
+		string suffix = "/" + to_string(nBeats) + "beats";
+
+		// Time per character of the tune
+		suite.measure("piano/isTuneWellFormed" + suffix, tune.size(), [&] {
+			return (long long)piano::isTuneWellFormed(tune);
+		});
+		suite.measure("piano/translateTune" + suffix, tune.size(), [&] {
+			string instructions;
+			int badBeat = -1;
+			return piano::translateTune(tune, instructions, badBeat) +
+				(long long)instructions.size();
+		});
+	}
+}
+
+void benchmarkWordFinder(BenchmarkSuite& suite)
+{
+	using namespace wordfinder;
+	typedef char RuleWord[MAX_WORD_LENGTH + 1];
+	typedef array<char, MAX_WORD_LENGTH + 1> RuleWordArray;
+
+	// Rule sets from a small vocabulary have many duplicates to remove.
+	const int RULES[] = { 100, 10000 };
+	for (int nRules : RULES)
+	{
+		mt19937 gen(4 + nRules);
+		vector<string> vocab = makeRandomVocabulary(gen, nRules / 10 + 10);
+		vector<int> distance;
+		vector<RuleWordArray> word1, word2;
+		makeRandomRules(gen, vocab, nRules, 10, distance, word1, word2);
+		vector<int> d;
+		vector<RuleWordArray> w1, w2;
+
+		// standardizeRules changes the rules, so each call works on a new
+		// copy of them; the time includes the copying.
+		suite.measure("wordfinder/standardizeRules/" + to_string(nRules) +
+			"rules", nRules, [&] {
+			d = distance;
+			w1 = word1;
+			w2 = word2;
+			return standardizeRules(d.data(),
+				reinterpret_cast<RuleWord*>(w1.data()),
+				reinterpret_cast<RuleWord*>(w2.data()), nRules);
+		});
+	}
+
+	const int DOCUMENT_WORDS[] = { 30, 100000 };
+	for (int nRules : RULES)
+	{
+		for (int nWords : DOCUMENT_WORDS)
+		{
+			mt19937 gen(5 + nRules + nWords);
+			vector<string> vocab = makeRandomVocabulary(gen, 1000);
+			vector<int> distance;
+			vector<RuleWordArray> word1, word2;
+			makeRandomRules(gen, vocab, nRules, 10, distance, word1, word2);
+			string document = makeRandomDocument(gen, vocab, nWords);
+
+			// Time per word of the document
+			suite.measure("wordfinder/determineQuality/" + to_string(nRules) +
+				"rules/" + to_string(nWords) + "words", nWords, [&] {
+				return determineQuality(distance.data(),
+					reinterpret_cast<const RuleWord*>(word1.data()),
+					reinterpret_cast<const RuleWord*>(word2.data()), nRules,
+					document.c_str());
+			});
+		}
+	}
+}
+
+// Random rules over the words of vocab, in the arrays determineQuality
+// takes
+struct WordFinderRules
+{
+	typedef char RuleWord[wordfinder::MAX_WORD_LENGTH + 1];
+
+	vector<int> distance;
+	vector<array<char, wordfinder::MAX_WORD_LENGTH + 1>> word1, word2;
+
+	WordFinderRules(mt19937& gen, const vector<string>& vocab, int nRules,
+		int maxDistance)
+	{
+		wordfinder::makeRandomRules(gen, vocab, nRules, maxDistance, distance,
+			word1, word2);
+	}
+
+	int count() const { return int(distance.size()); }
+	const RuleWord* w1() const { return reinterpret_cast<const RuleWord*>(word1.data()); }
+	const RuleWord* w2() const { return reinterpret_cast<const RuleWord*>(word2.data()); }
+};
+
+// The position index and the one-pass scorer, checked against
+// determineQuality on small documents, where it is the reference, and
+// timed on one large document
+void benchmarkWordFinderIndex(BenchmarkSuite& suite)
+{
+	using namespace wordfinder;
+	suite.check("wordfinder/determineQualityIndexed/check", [](string& detail) {
+		mt19937 gen(6);
+		const int N_TRIALS = 2000;
+		int nMismatches = 0;
+		for (int t = 0; t < N_TRIALS; t++)
+		{
+			vector<string> vocab = makeRandomVocabulary(gen, 12);
+			WordFinderRules rules(gen, vocab, 20, 4);
+			string document = makeRandomDocument(gen, vocab, 20);
+			document.resize(min<size_t>(document.size(), MAX_DOCUMENT_LENGTH));
+			int expected = determineQuality(rules.distance.data(), rules.w1(),
+				rules.w2(), rules.count(), document.c_str());
+			if (determineQualityIndexed(rules.distance.data(), rules.w1(), rules.w2(),
+					rules.count(), document.c_str()) != expected)
+				nMismatches++;
+			if (determineQualityOfText(rules.distance.data(), rules.w1(), rules.w2(),
+					rules.count(), document.data(), document.size()) != expected)
+				nMismatches++;
+		}
+		detail = to_string(nMismatches) + " mismatches in " + to_string(N_TRIALS) +
+			" small documents";
+		return nMismatches == 0;
+	});
+
+	const int N_RULES = 10000;
+	const int N_WORDS = 1000000;
+	string suffix = "/" + to_string(N_RULES) + "rules/" + to_string(N_WORDS) + "words";
+	vector<string> names = { "wordfinder/indexDocument/" + to_string(N_WORDS) + "words",
+		"wordfinder/determineQualityIndexed" + suffix,
+		"wordfinder/determineQualityOfText" + suffix,
+		"wordfinder/determineQualityOfText/check" + suffix };
+	if (!suite.anySelected(names))
+		return;
+	mt19937 gen(7);
+	vector<string> vocab = makeRandomVocabulary(gen, 50000);
+	WordFinderRules rules(gen, vocab, N_RULES, 10);
+	string document = makeRandomDocument(gen, vocab, N_WORDS);
+	DocumentIndex index;
+	indexDocument(document.c_str(), index);
+
+	// Time per word of the document
+	suite.measure(names[0], N_WORDS, [&] {
+		DocumentIndex index;
+		indexDocument(document.c_str(), index);
+		return (long long)index.nWords;
+	});
+
+	// Time per rule, given the index
+	suite.measure(names[1], N_RULES, [&] {
+		return determineQualityIndexed(rules.distance.data(), rules.w1(), rules.w2(),
+			N_RULES, index);
+	});
+
+	// Time per word of the document
+	suite.measure(names[2], N_WORDS, [&] {
+		return determineQualityOfText(rules.distance.data(), rules.w1(), rules.w2(),
+			N_RULES, document.data(), document.size());
+	});
+
+	suite.check(names[3], [&](string& detail) {
+		int indexed = determineQualityIndexed(rules.distance.data(), rules.w1(),
+			rules.w2(), N_RULES, index);
+		int streamed = determineQualityOfText(rules.distance.data(), rules.w1(),
+			rules.w2(), N_RULES, document.data(), document.size());
+		detail = "quality " + to_string(streamed) + ", indexed " + to_string(indexed);
+		return streamed == indexed;
+	});
+}
+
+// Scoring a corpus with 1, 2 and 4 threads.  Documents per minute is
+// 6e10 divided by ns_per_op.
+void benchmarkWordFinderCorpus(BenchmarkSuite& suite)
+{
+	using namespace wordfinder;
+	const int N_RULES = 1000;
+	const int N_DOCUMENTS = 10000;
+	const int DOCUMENT_WORDS = 300;
+	const int THREADS[] = { 1, 2, 4 };
+	string prefix = "wordfinder/scoreCorpus/" + to_string(N_RULES) + "rules/" +
+		to_string(N_DOCUMENTS) + "docs/";
+	vector<string> names = { "wordfinder/scoreCorpus/check" };
+	for (int nThreads : THREADS)
+		names.push_back(prefix + to_string(nThreads) + "threads");
+	if (!suite.anySelected(names))
+		return;
+
+	mt19937 gen(8);
+	vector<string> vocab = makeRandomVocabulary(gen, 5000);
+	WordFinderRules ruleArrays(gen, vocab, N_RULES, 5);
+	CompiledRuleSet rules(ruleArrays.distance.data(), ruleArrays.w1(), ruleArrays.w2(),
+		N_RULES);
+	vector<string> documents(N_DOCUMENTS);
+	for (string& document : documents)
+		document = makeRandomDocument(gen, vocab, DOCUMENT_WORDS);
+
+	// determineQualityIndexed splits words and matches rules on its own,
+	// so it makes a reference for the compiled rules and the tokenizer.
+	suite.check(names[0], [&](string& detail) {
+		vector<int> qualities;
+		scoreCorpus(rules, documents, THREADS[size(THREADS) - 1], qualities);
+		int nMismatches = 0;
+		for (int k = 0; k < N_DOCUMENTS && k < 1000; k++)
+		{
+			if (determineQualityIndexed(ruleArrays.distance.data(), ruleArrays.w1(),
+					ruleArrays.w2(), N_RULES, documents[k].c_str()) != qualities[k])
+				nMismatches++;
+		}
+		detail = to_string(nMismatches) + " mismatches in 1000 documents";
+		return nMismatches == 0;
+	});
+
+	for (size_t t = 0; t < size(THREADS); t++)
+	{
+		suite.measure(names[t + 1], N_DOCUMENTS, [&] {
+			vector<int> qualities;
+			scoreCorpus(rules, documents, THREADS[t], qualities);
+			return (long long)qualities.back();
+		});
+	}
+}
+
+// Adds up the words handed out by a DocumentTokenizer
+struct TokenChecksum
+{
+	unsigned long long nWords = 0;
+	unsigned long long sum = 0;
+
+	void operator()(string_view word)
+	{
+		// Cheap, so that the benchmark measures the tokenizer
+		nWords++;
+		sum = sum * 31 + word.size() * 257 +
+			static_cast<unsigned char>(word[0]) * 7 +
+			static_cast<unsigned char>(word[word.size() - 1]);
+	}
+};
+
+// Tokenizing random text (words of varying length, some with capitals,
+// digits or punctuation, and runs of blanks) one character at a time and
+// a block at a time.  Time is per byte, so GB/s is 1 divided by
+// ns_per_op.
+void benchmarkWordFinderTokenizer(BenchmarkSuite& suite)
+{
+	using namespace wordfinder;
+	const int MEGABYTES = 16;
+	string suffix = "/" + to_string(MEGABYTES) + "MB";
+	vector<string> names = { "wordfinder/tokenizer/check",
+		"wordfinder/tokenizer/scalar" + suffix, "wordfinder/tokenizer/block" + suffix };
+	if (!suite.anySelected(names))
+		return;
+
+	mt19937 gen(9);
+	uniform_int_distribution<int> pickLength(1, 30);
+	uniform_int_distribution<int> pickLetter('a', 'z');
+	uniform_int_distribution<int> pickPercent(0, 99);
+	const char OTHERS[] = "0123456789.,;:!?'-()\t\n\x80\xe9";
+	string text;
+	size_t size = size_t(MEGABYTES) << 20;
+	while (text.size() < size)
+	{
+		int length = pickLength(gen);
+		for (int k = 0; k < length; k++)
+		{
+			int percent = pickPercent(gen);
+			if (percent < 3)
+				text += OTHERS[percent * (sizeof(OTHERS) - 1) / 3];
+			else if (percent < 8)
+				text += char(toupper(pickLetter(gen)));
+			else
+				text += char(pickLetter(gen));
+		}
+		text += (pickPercent(gen) < 10 ? "  " : " ");
+	}
+
+	suite.check(names[0], [&](string& detail) {
+		TokenChecksum scalarWords;
+		DocumentTokenizer scalar;
+		scalar.feedScalar(text.data(), text.size(), scalarWords);
+		scalar.finish(scalarWords);
+		TokenChecksum blockWords;
+		DocumentTokenizer block;
+		block.feed(text.data(), text.size(), blockWords);
+		block.finish(blockWords);
+		bool same = blockWords.nWords == scalarWords.nWords &&
+			blockWords.sum == scalarWords.sum;
+		detail = to_string(blockWords.nWords) + " words a block at a time, " +
+			(same ? "the same as" : "different from") + " a character at a time";
+		return same;
+	});
+
+	suite.measure(names[1], text.size(), [&] {
+		TokenChecksum words;
+		DocumentTokenizer tokenizer;
+		tokenizer.feedScalar(text.data(), text.size(), words);
+		tokenizer.finish(words);
+		return (long long)words.sum;
+	});
+	suite.measure(names[2], text.size(), [&] {
+		TokenChecksum words;
+		DocumentTokenizer tokenizer;
+		tokenizer.feed(text.data(), text.size(), words);
+		tokenizer.finish(words);
+		return (long long)words.sum;
+	});
+}
+
+// Random edits to documents of 10^4 to 10^6 words, each inserting or
+// erasing one to five words anywhere, timed against a full rescore.  The
+// time per edit should not grow with the document.
+void benchmarkWordFinderIncremental(BenchmarkSuite& suite)
+{
+	using namespace wordfinder;
+	const int N_RULES = 10000;
+	const int DOCUMENT_WORDS[] = { 10000, 100000, 1000000 };
+	vector<string> names = { "wordfinder/IncrementalScorer/check" };
+	for (int nWords : DOCUMENT_WORDS)
+	{
+		string suffix = "/" + to_string(N_RULES) + "rules/" + to_string(nWords) + "words";
+		names.push_back("wordfinder/IncrementalScorer/edit" + suffix);
+		names.push_back("wordfinder/DocumentScorer/rescore" + suffix);
+	}
+	if (!suite.anySelected(names))
+		return;
+
+	mt19937 gen(10);
+	vector<string> vocab = makeRandomVocabulary(gen, 2000);
+	WordFinderRules ruleArrays(gen, vocab, N_RULES, 10);
+	CompiledRuleSet rules(ruleArrays.distance.data(), ruleArrays.w1(), ruleArrays.w2(),
+		N_RULES);
+	uniform_int_distribution<size_t> pickWord(0, vocab.size() - 1);
+	auto randomText = [&](int nWords) {
+		string text;
+		for (int k = 0; k < nWords; k++)
+			text += vocab[pickWord(gen)] + ' ';
+		return text;
+	};
+
+	// The document is also kept word by word, to be rescored after every
+	// edit.  It starts big enough to be split over several blocks, and an
+	// occasional long edit splits and merges them.
+	suite.check(names[0], [&](string& detail) {
+		const int N_EDITS = 2000;
+		IncrementalScorer scorer(rules);
+		DocumentScorer full(rules);
+		vector<string> words;
+		int nMismatches = 0;
+		for (int e = 0; e <= N_EDITS; e++)
+		{
+			long long pos = gen() % (words.size() + 1);
+			long long n = (e == 0 ? 20000 : gen() % 50 == 0 ? 1 + gen() % 5000 : 1 + gen() % 5);
+			if (e > 0 && gen() % 2 == 0 && !words.empty())
+			{
+				pos = min<long long>(pos, words.size() - 1);
+				n = min<long long>(n, words.size() - pos);
+				scorer.erase(pos, n);
+				words.erase(words.begin() + pos, words.begin() + pos + n);
+			}
+			else
+			{
+				string added = randomText(int(n));
+				scorer.insert(pos, added.data(), added.size());
+				vector<string> newWords;
+				for (size_t k = 0, start = 0; k < added.size(); k++)
+					if (added[k] == ' ')
+					{
+						newWords.push_back(added.substr(start, k - start));
+						start = k + 1;
+					}
+				words.insert(words.begin() + pos, newWords.begin(), newWords.end());
+			}
+			string document;
+			for (const string& word : words)
+				document += word + ' ';
+			if (full.score(document.data(), document.size()) != scorer.quality() ||
+					scorer.wordCount() != (long long)words.size())
+				nMismatches++;
+		}
+		detail = to_string(nMismatches) + " mismatches in " + to_string(N_EDITS) +
+			" edits";
+		return nMismatches == 0;
+	});
+
+	for (size_t k = 0; k < size(DOCUMENT_WORDS); k++)
+	{
+		string document = randomText(DOCUMENT_WORDS[k]);
+		IncrementalScorer scorer(rules);
+		scorer.append(document.data(), document.size());
+
+		// Each run inserts a few words somewhere and erases as many
+		// somewhere else, so the document keeps its size; time is per edit.
+		suite.measure(names[1 + 2 * k], 2, [&] {
+			int n = 1 + gen() % 5;
+			string added = randomText(n);
+			scorer.insert(gen() % (scorer.wordCount() + 1), added.data(), added.size());
+			scorer.erase(gen() % (scorer.wordCount() - n + 1), n);
+			return (long long)scorer.quality();
+		});
+
+		DocumentScorer full(rules);
+		suite.measure(names[2 + 2 * k], 1, [&] {
+			return (long long)full.score(document.data(), document.size());
+		});
+	}
+}
+
+// Finding the top k documents of a corpus, with pruning and by a full
+// scan.  The check reports the fraction of documents each bound pruned.
+void benchmarkWordFinderRanking(BenchmarkSuite& suite)
+{
+	using namespace wordfinder;
+	const int N_RULES = 10000;
+	const int N_DOCUMENTS = 1000000;
+	const int MAX_DOCUMENT_WORDS = 50;
+	const int K = 10;
+	string suffix = "/" + to_string(N_RULES) + "rules/" + to_string(N_DOCUMENTS) +
+		"docs/top" + to_string(K);
+	vector<string> names = { "wordfinder/rankTopDocuments/check",
+		"wordfinder/rankTopDocuments" + suffix, "wordfinder/rankByFullScan" + suffix };
+	if (!suite.anySelected(names))
+		return;
+
+	mt19937 gen(11);
+	vector<string> vocab = makeRandomVocabulary(gen, 20000);
+	WordFinderRules ruleArrays(gen, vocab, N_RULES, 5);
+	CompiledRuleSet rules(ruleArrays.distance.data(), ruleArrays.w1(), ruleArrays.w2(),
+		N_RULES);
+	uniform_int_distribution<int> pickLength(5, MAX_DOCUMENT_WORDS);
+	vector<string> documents(N_DOCUMENTS);
+	for (string& document : documents)
+		document = makeRandomDocument(gen, vocab, pickLength(gen));
+
+	// The first k of the documents sorted by quality, ties going to the
+	// earlier document
+	auto rankByFullScan = [&] {
+		vector<int> qualities;
+		scoreCorpus(rules, documents, 1, qualities);
+		vector<RankedDocument> all(N_DOCUMENTS);
+		for (int d = 0; d < N_DOCUMENTS; d++)
+			all[d] = RankedDocument{ size_t(d), qualities[d] };
+		stable_sort(all.begin(), all.end(),
+			[](const RankedDocument& a, const RankedDocument& b) {
+				return a.quality > b.quality;
+			});
+		all.resize(min(N_DOCUMENTS, K));
+		return all;
+	};
+
+	suite.check(names[0], [&](string& detail) {
+		RankingStats stats;
+		vector<RankedDocument> top = rankTopDocuments(rules, documents, K, &stats);
+		vector<RankedDocument> all = rankByFullScan();
+		bool same = (top.size() == all.size());
+		for (size_t i = 0; same && i < top.size(); i++)
+			same = (top[i].document == all[i].document && top[i].quality == all[i].quality);
+		char text[200];
+		snprintf(text, sizeof(text), "%s a full scan; pruned %.1f%% by word count, "
+			"%.1f%% by word pairs", same ? "the same as" : "different from",
+			100.0 * stats.nPrunedByWordCount / N_DOCUMENTS,
+			100.0 * stats.nPrunedByWordPairs / N_DOCUMENTS);
+		detail = text;
+		return same;
+	});
+
+	// Time per document
+	suite.measure(names[1], N_DOCUMENTS, [&] {
+		return (long long)rankTopDocuments(rules, documents, K).front().quality;
+	});
+	suite.measure(names[2], N_DOCUMENTS, [&] {
+		return (long long)rankByFullScan().front().quality;
+	});
+}
+
+// Loading a saved rule set against standardizing and compiling the rules
+void benchmarkWordFinderRuleSetFile(BenchmarkSuite& suite)
+{
+	using namespace wordfinder;
+	const int N_RULES = 1000000;
+	const char PATH[] = "benchmark-rules.tmp";
+	string suffix = "/" + to_string(N_RULES) + "rules";
+	vector<string> names = { "wordfinder/CompiledRuleSet/check",
+		"wordfinder/CompiledRuleSet/load" + suffix,
+		"wordfinder/CompiledRuleSet/compile" + suffix };
+	if (!suite.anySelected(names))
+		return;
+
+	mt19937 gen(12);
+	vector<string> vocab = makeRandomVocabulary(gen, 100000);
+	WordFinderRules ruleArrays(gen, vocab, N_RULES, 10);
+	WordFinderRules standard = ruleArrays;
+	int nStandardRules = standardizeRules(standard.distance.data(),
+		reinterpret_cast<WordFinderRules::RuleWord*>(standard.word1.data()),
+		reinterpret_cast<WordFinderRules::RuleWord*>(standard.word2.data()), N_RULES);
+	CompiledRuleSet compiled(standard.distance.data(), standard.w1(), standard.w2(),
+		nStandardRules);
+	if (!compiled.save(PATH))
+	{
+		cout << "Cannot write " << PATH << endl;
+		exit(1);
+	}
+
+	suite.check(names[0], [&](string& detail) {
+		CompiledRuleSet loaded;
+		if (!loaded.load(PATH))
+		{
+			detail = string("cannot load ") + PATH;
+			return false;
+		}
+		DocumentScorer compiledScorer(compiled);
+		DocumentScorer loadedScorer(loaded);
+		int nMismatches = 0;
+		for (int d = 0; d < 1000; d++)
+		{
+			string document = makeRandomDocument(gen, vocab, 1000);
+			if (compiledScorer.score(document.data(), document.size()) !=
+					loadedScorer.score(document.data(), document.size()))
+				nMismatches++;
+		}
+		detail = to_string(nStandardRules) + " rules; " + to_string(nMismatches) +
+			" mismatches in 1000 documents";
+		return nMismatches == 0;
+	});
+
+	// Time per rule set
+	suite.measure(names[1], 1, [&] {
+		CompiledRuleSet loaded;
+		return (long long)(loaded.load(PATH) ? loaded.ruleCount() : -1);
+	});
+
+	// standardizeRules changes the rules, so each call works on a new copy
+	// of them; the time includes the copying.
+	suite.measure(names[2], 1, [&] {
+		WordFinderRules copy = ruleArrays;
+		int n = standardizeRules(copy.distance.data(),
+			reinterpret_cast<WordFinderRules::RuleWord*>(copy.word1.data()),
+			reinterpret_cast<WordFinderRules::RuleWord*>(copy.word2.data()), N_RULES);
+		CompiledRuleSet rules(copy.distance.data(), copy.w1(), copy.w2(), n);
+		return (long long)rules.ruleCount();
+	});
+	remove(PATH);
+}
+
+void benchmarkSnake(BenchmarkSuite& suite)
+{
+	const int ROWS = 100;
+	const int COLS = 100;
+	const double DENSITIES[] = { 0.05, 0.2, 0.5 };
+	for (double density : DENSITIES)
+	{
+		// The player stays put, so no snake is destroyed and every turn
+		// moves the same number of snakes.
+		snake::Pit pit(ROWS, COLS, 6);
+		snake::RandomGenerator random(7);
+		pit.addPlayer(1 + random.below(ROWS), 1 + random.below(COLS));
+		int nSnakes = int(density * ROWS * COLS);
+		for (int k = 0; k < nSnakes; k++)
+			pit.addSnake(1 + random.below(ROWS), 1 + random.below(COLS));
+
+		// Time per snake moved
+		char name[100];
+		snprintf(name, sizeof(name), "snake/moveSnakes/%dx%d/%g", ROWS, COLS,
+			density);
+		suite.measure(name, pit.snakeCount(), [&] {
+			return (long long)pit.moveSnakes();
+		});
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  main
+///////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[])
+{
+	// Options:
+	//   --filter=TEXT         run only benchmarks whose names contain TEXT
+	//   --sample-time=S       seconds per sample (default 0.05)
+	//   --output=FILE         write the JSON results to FILE, not stdout
+	//   --compare=FILE        compare the results with those saved in FILE,
+	//                         exiting with status 1 if any is more than
+	//     --threshold=P         P percent slower (default 10)
+	// Checks that a fast path gives the same results as a reference are
+	// selected by --filter like benchmarks, and the suite exits with status
+	// 1 if any fails.
+	// Built with ALLOCATION_ACCOUNTING, the suite also records what one run
+	// of each benchmark allocates, and exits with status 1 if any is over
+	// its budget in ALLOCATION_BUDGETS.
+	string filter;
+	double sampleSeconds = 0.05;
+	string outputPath;
+	string baselinePath;
+	double thresholdPercent = 10;
+	for (int k = 1; k < argc; k++)
+	{
+		string value;
+		if (optionValue(argv[k], "filter", value))
+			filter = value;
+		else if (optionValue(argv[k], "sample-time", value))
+			sampleSeconds = atof(value.c_str());
+		else if (optionValue(argv[k], "output", value))
+			outputPath = value;
+		else if (optionValue(argv[k], "compare", value))
+			baselinePath = value;
+		else if (optionValue(argv[k], "threshold", value))
+			thresholdPercent = atof(value.c_str());
+		else
+		{
+			cout << "Unknown option " << argv[k] << endl;
+			exit(1);
+		}
+	}
+	if (sampleSeconds <= 0 || thresholdPercent < 0)
+	{
+		cout << "The sample time must be positive and the threshold nonnegative."
+			<< endl;
+		exit(1);
+	}
+
+	// Read the baseline first, so a bad path fails before the long run.
+	map<string, double> baseline;
+	if (!baselinePath.empty() && !readBaseline(baselinePath, baseline))
+	{
+		cout << "Cannot read " << baselinePath << endl;
+		exit(1);
+	}
+
+	BenchmarkSuite suite(filter, sampleSeconds);
+	benchmarkArrays(suite);
+	benchmarkPhoneBill(suite);
+	benchmarkPiano(suite);
+	benchmarkWordFinder(suite);
+	benchmarkWordFinderIndex(suite);
+	benchmarkWordFinderCorpus(suite);
+	benchmarkWordFinderTokenizer(suite);
+	benchmarkWordFinderIncremental(suite);
+	benchmarkWordFinderRanking(suite);
+	benchmarkWordFinderRuleSetFile(suite);
+	benchmarkSnake(suite);
+
+	if (outputPath.empty())
+	{
+		if (baselinePath.empty())
+			suite.writeJson(cout);
+	}
+	else
+	{
+		ofstream out(outputPath);
+		if (!suite.writeJson(out))
+		{
+			cout << "Cannot write " << outputPath << endl;
+			exit(1);
+		}
+	}
+
+	int status = 0;
+	if (suite.failedCheckCount() > 0)
+	{
+		cout << suite.failedCheckCount() << " checks failed" << endl;
+		status = 1;
+	}
+	if (!baselinePath.empty() &&
+			compareWithBaseline(suite.results(), baseline, thresholdPercent) > 0)
+		status = 1;
+#ifdef ALLOCATION_ACCOUNTING
+	if (checkAllocationBudgets(suite.results()) > 0)
+		status = 1;
+#endif
+	return status;
+}
@@ -0,0 +1,22 @@
+// Command-line option parsing shared by the programs that take options.
+// A program that includes another inside a namespace includes this header
+// first, so both use the one optionValue.
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstring>
+#include <string>
+
+// If arg is "--name=value", set value and return true.
+inline bool optionValue(const char* arg, const char* name, std::string& value)
+{
+	std::size_t len = std::strlen(name);
+	if (std::strncmp(arg, "--", 2) != 0 || std::strncmp(arg + 2, name, len) != 0 ||
+			arg[2 + len] != '=')
+		return false;
+	value = arg + 3 + len;
+	return true;
+}
+
+#endif  // OPTIONS_H
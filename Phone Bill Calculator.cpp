@@ -1,8 +1,38 @@
 #include <iostream>
 #include <string>
+#include "Allocation Accounting.h"
 
 using namespace std;
 
+// Return the bill for a month (1 through 12) in which minutes minutes and
+// texts text messages were used
+double computeBill(int minutes, int texts, int month)
+{
+	ALLOCATION_SCOPE("computeBill");
+	double R; //R is rate
+	if (month <= 5 || month >= 10) 
+		R = .03;
+	else 
+		R = .02;
+
+	double cost=40.00;
+
+	if (minutes > 500) //if minutes max out
+		cost = cost + (minutes - 500)*.45;
+
+
+	if (texts <= 200) //if texts stay below 200, dont need to pay extra 
+		cost = cost;
+
+	else if (texts <= 400) //if texts exceed, need to pay extra
+		cost = cost + (texts - 200)*R;
+
+	else if (texts > 400) //if texts exceed 400, need to pay .11 per extra text
+		cost = cost + 200 * R + (texts - 400)*.11;
+
+	return cost;
+}
+
 int main()
 {
 	// acquire minutes
@@ -27,26 +57,7 @@ int main()
 		cin >> month;
 
 	// calculate bill
-		double R; //R is rate
-		if (month <= 5 || month >= 10) 
-			R = .03;
-		else 
-			R = .02;
-
-		double cost=40.00;
-
-		if (minutes > 500) //if minutes max out
-			cost = cost + (minutes - 500)*.45;
-
-
-		if (texts <= 200) //if texts stay below 200, dont need to pay extra 
-			cost = cost;
-
-		else if (texts <= 400) //if texts exceed, need to pay extra
-			cost = cost + (texts - 200)*R;
-
-		else if (texts > 400) //if texts exceed 400, need to pay .11 per extra text
-			cost = cost + 200 * R + (texts - 400)*.11;
+		double cost = computeBill(minutes, texts, month);
 
 		cout << "---" << endl;
 
@@ -66,4 +77,5 @@ int main()
 			cout.precision(2);
 			cout << "The bill for " << name << " is $" << cost;
 		}
+		return 0;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <string>
+#include "Allocation Accounting.h"
 
 using namespace std;
 
@@ -14,6 +15,7 @@ const int DEFAULT_OCTAVE = 4;
 
 bool isTuneWellFormed(string tune)
 {
+	ALLOCATION_SCOPE("isTuneWellFormed");
 	// An empty tune is well-formed.
 
 	if (tune.size() == 0)
@@ -72,6 +74,7 @@ bool isTuneWellFormed(string tune)
 
 int translateTune(string tune, string& instructions, int& badBeat)
 {
+	ALLOCATION_SCOPE("translateTune");
 	// Define return values
 
 	const int RET_OK = 0;
@@ -191,6 +194,7 @@ int translateTune(string tune, string& instructions, int& badBeat)
 
 char translateNote(int octave, char noteLetter, char accidentalSign)
 {
+	ALLOCATION_SCOPE("translateNote");
 	// This check is here solely to report a common CS 31 student error.
 	if (octave > 9)
 	{
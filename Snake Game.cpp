@@ -1,21 +1,44 @@
 #include <iostream>
 #include <string>
+#include <vector>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#ifdef _MSC_VER
+#include <conio.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#endif
+#include "Allocation Accounting.h"
+#include "Options.h"
 using namespace std;
 
 ///////////////////////////////////////////////////////////////////////////
 // Manifest constants
 ///////////////////////////////////////////////////////////////////////////
 
-const int MAXROWS = 20;             // max number of rows in the pit
-const int MAXCOLS = 40;             // max number of columns in the pit
-const int MAXSNAKES = 180;          // max number of snakes allowed
-
 const int UP = 0;
 const int DOWN = 1;
 const int LEFT = 2;
 const int RIGHT = 3;
+const int NOT_MOVED = 4;  // what stepSnakes records for a snake at a wall
 
 ///////////////////////////////////////////////////////////////////////////
 //  Auxiliary function declarations
@@ -23,32 +46,175 @@ const int RIGHT = 3;
 
 int decodeDirection(char dir);
 bool directionToDeltas(int dir, int& rowDelta, int& colDelta);
+bool stepSnakes(int* rows, int* cols, const unsigned long long* directionBits,
+	int* moves, int n, int nRows, int nCols, int playerRow, int playerCol);
+bool stepSnakesScalar(int* rows, int* cols, const unsigned long long* directionBits,
+	int* moves, int first, int last, int nRows, int nCols, int playerRow, int playerCol);
 void clearScreen();
 
+///////////////////////////////////////////////////////////////////////////
+//  Profiling
+///////////////////////////////////////////////////////////////////////////
+
+// Compiled with SNAKE_PROFILE defined, the game times the sections of code
+// below, keeping a histogram of the times for each, and counts the events
+// below; --profile=FILE writes them to a JSON file at the end.  Otherwise
+// PROFILE_SCOPE and PROFILE_COUNT compile to nothing.
+
+#ifdef SNAKE_PROFILE
+
+enum ProfileSection
+{
+	PROFILE_TICK,         // one turn:  the player's action and the snakes' moves
+	PROFILE_PLAYER_MOVE,  // Player::move, with its numberOfSnakesAt queries
+	PROFILE_MOVE_SNAKES,  // Pit::moveSnakes
+	PROFILE_DISPLAY,      // Pit::display
+	PROFILE_INPUT,        // waiting for the player to type a move
+	N_PROFILE_SECTIONS
+};
+
+enum ProfileCounter
+{
+	PROFILE_SNAKE_QUERIES,    // calls of Pit::numberOfSnakesAt
+	PROFILE_SNAKES_MOVED,     // snakes moved by Pit::moveSnakes
+	PROFILE_SNAKES_DESTROYED,
+	PROFILE_FRAME_BYTES,      // sent to the terminal by TerminalRenderer
+	N_PROFILE_COUNTERS
+};
+
+// Times in nanoseconds, kept in buckets 1/8 of a power of two wide (so a
+// percentile is within 12.5%), with the exact count, total and maximum.
+// Threads may add to it at once.
+class TimeHistogram
+{
+public:
+	static const int SUB_BUCKETS = 8;
+	static const int N_BUCKETS = 64 * SUB_BUCKETS;
+
+	TimeHistogram();
+	void      add(long long ns);
+	long long count() const;
+	long long total() const;
+	long long maximum() const;
+	long long percentile(double p) const;  // p from 0 to 100
+
+private:
+	static int bucketOf(long long ns);
+	static long long bucketTop(int b);
+
+	atomic<long long> m_buckets[N_BUCKETS];
+	atomic<long long> m_count;
+	atomic<long long> m_total;
+	atomic<long long> m_maximum;
+};
+
+class Profiler
+{
+public:
+	void addTime(ProfileSection section, long long ns);
+	void count(ProfileCounter counter, long long n = 1);
+	bool write(string path) const;
+
+private:
+	TimeHistogram     m_times[N_PROFILE_SECTIONS];
+	atomic<long long> m_counters[N_PROFILE_COUNTERS] = {};
+};
+
+Profiler& profiler();
+
+// Times the rest of the block it's declared in
+class ScopedTimer
+{
+public:
+	ScopedTimer(ProfileSection section);
+	~ScopedTimer();
+
+private:
+	ProfileSection m_section;
+	chrono::steady_clock::time_point m_start;
+};
+
+#define PROFILE_SCOPE(section)  ScopedTimer profileTimer(section)
+#define PROFILE_COUNT(counter, n)  profiler().count(counter, n)
+
+#else
+
+#define PROFILE_SCOPE(section)
+#define PROFILE_COUNT(counter, n)
+
+#endif
+
 ///////////////////////////////////////////////////////////////////////////
 // Type definitions
 ///////////////////////////////////////////////////////////////////////////
 
+// A fast random number generator (xoshiro256**).  Each Pit has its own,
+// so games are independent of each other (and can run on different
+// threads), and a game started with a given seed always plays out the
+// same way.
+class RandomGenerator
+{
+public:
+	RandomGenerator(unsigned long long seed = 0);
+
+	unsigned long long next();
+
+	// Return a random integer from 0 through n-1, for 0 < n < 2^32.
+	int below(int n);
+
+	// Copy the generator's state to or from state
+	void getState(unsigned long long state[4]) const;
+	void setState(const unsigned long long state[4]);
+
+private:
+	unsigned long long m_state[4];
+};
+
+// Draws frames (a grid of characters above some lines of status) on the
+// terminal.  It remembers the last frame it drew, and sends only the cells
+// that changed, positioning the cursor with ANSI escape sequences, and
+// rewrites the status lines; a frame is sent with a single write.
+class TerminalRenderer
+{
+public:
+	TerminalRenderer();
+
+	// Set frame to what must be sent to the terminal to replace the last
+	// frame with this one
+	void compose(const vector<string>& grid, const string& status, string& frame);
+
+	// Draw a frame
+	void draw(const vector<string>& grid, const string& status);
+
+	// Forget the last frame, so the next is drawn in full
+	void reset();
+
+private:
+	vector<string> m_previous;
+	bool           m_redrawAll;  // the terminal can't take escape sequences
+	string         m_frame;
+};
+
 class Pit;  // This is needed to let the compiler know that Pit is a
 // type name, since it's mentioned in the Snake declaration.
 
+// The snakes' positions are stored by their Pit, in arrays; a Snake is a
+// lightweight view of the kth snake of a Pit.
 class Snake
 {
 public:
 	// Constructor
-	Snake(Pit* pp, int r, int c);
+	Snake(Pit* pp, int k);
 
 	// Accessors
 	int  row() const;
 	int  col() const;
 
-	// Mutators
-	void move();
+	// Snakes are moved all at once, by Pit::moveSnakes.
 
 private:
 	Pit* m_pit;
-	int  m_row;
-	int  m_col;
+	int  m_index;
 };
 
 class Player
@@ -67,6 +233,7 @@ public:
 	void   stand();
 	void   move(int dir);
 	void   setDead();
+	void   restore(int r, int c, int age, bool dead);
 
 private:
 	Pit*  m_pit;
@@ -76,11 +243,25 @@ private:
 	bool  m_dead;
 };
 
+// Everything about a pit that changes as a game is played
+struct PitState
+{
+	unsigned long long random[4];  // the pit's RandomGenerator
+	int  playerRow;                // 0 if there is no player
+	int  playerCol;
+	int  playerAge;
+	bool playerDead;
+	vector<int> snakeRows;
+	vector<int> snakeCols;
+
+	bool operator==(const PitState& other) const;
+};
+
 class Pit
 {
 public:
 	// Constructor/destructor
-	Pit(int nRows, int nCols);
+	Pit(int nRows, int nCols, unsigned long long seed);
 	~Pit();
 
 	// Accessors
@@ -88,127 +269,839 @@ public:
 	int     cols() const;
 	Player* player() const;
 	int     snakeCount() const;
+	Snake   snake(int k);
 	int     numberOfSnakesAt(int r, int c) const;
 	void    display(string msg) const;
+	vector<string> picture() const;
+	string  status(string msg) const;
+	RandomGenerator& random();
 
 	// Mutators
 	bool   addSnake(int r, int c);
 	bool   addPlayer(int r, int c);
 	bool   destroyOneSnake(int r, int c);
 	bool   moveSnakes();
+	bool   takeTurn(char action);
+	void   saveState(PitState& state) const;
+	void   restoreState(const PitState& state);
+
+	// Find snakes for numberOfSnakesAt and destroyOneSnake by looking at
+	// every snake, as Pit did before it had an occupancy grid, and stop
+	// keeping the grid, or go back to the grid.  For benchmarkTicks, which
+	// compares the two.
+	void   setScanForSnakes(bool scan);
 
 private:
+	friend class Snake;
+
+	int    cell(int r, int c) const;
+	void   linkSnake(int k);
+	void   unlinkSnake(int k, int r, int c);
+	void   relinkSnakes();
+
 	int     m_rows;
 	int     m_cols;
 	Player* m_player;
-	Snake*  m_snakes[MAXSNAKES];
-	int     m_nSnakes;
+	RandomGenerator m_random;
+	bool    m_scanForSnakes;
+
+	// Snake k is at (m_snakeRows[k],m_snakeCols[k]).  The snakes are kept
+	// in parallel arrays, rather than as separate objects, so that moving
+	// them all walks through memory in order.
+	vector<int> m_snakeRows;
+	vector<int> m_snakeCols;
+
+	// Occupancy grid:  for each position (see cell), the number of snakes
+	// there and a list (linked through m_nextSnake and m_prevSnake, in no
+	// particular order) of the numbers of the snakes there; -1 ends a list.
+	vector<int> m_nSnakesAt;
+	vector<int> m_firstSnakeAt;
+	vector<int> m_nextSnake;
+	vector<int> m_prevSnake;
+
+	// Scratch space for moveSnakes:  the random directions for a turn,
+	// and the moves the snakes made (see stepSnakes)
+	vector<unsigned long long> m_directionBits;
+	vector<int> m_moves;
+};
+
+// Chooses the player's action on each turn of a game played without a
+// human:  'u', 'd', 'l' or 'r' to move, ' ' to stand, or 'q' to quit.
+class PlayerPolicy
+{
+public:
+	virtual ~PlayerPolicy() {}
+	virtual char chooseAction(const Pit& pit) = 0;
+};
+
+// Moves in a random direction, or stands, with equal probability
+class RandomPolicy : public PlayerPolicy
+{
+public:
+	RandomPolicy(unsigned long long seed);
+	virtual char chooseAction(const Pit& pit);
+
+private:
+	RandomGenerator m_random;
+};
+
+// Takes the action that leaves the player, if alive, next to the fewest
+// snakes, preferring to kill a snake when that's no worse
+class GreedyEscapePolicy : public PlayerPolicy
+{
+public:
+	virtual char chooseAction(const Pit& pit);
+};
+
+// Takes the actions in a string, one per turn ('.' or ' ' meaning
+// stand), then stands
+class ScriptedPolicy : public PlayerPolicy
+{
+public:
+	ScriptedPolicy(string actions);
+	virtual char chooseAction(const Pit& pit);
+
+private:
+	string m_actions;
+	size_t m_next;
+};
+
+// The limits on the pits a CompactGameState can hold
+const int MAX_COMPACT_SIZE = 255;    // rows or columns
+const int MAX_COMPACT_SNAKES = 256;
+
+// The whole state of a game in a small pit, in one block of memory with
+// no pointers, so that it can be copied (to try something out and then
+// go back) with a plain assignment.  takeTurn follows the same rules as
+// Pit, drawing the same random numbers, so a state made from a pit goes on
+// exactly as the pit would.
+struct CompactGameState
+{
+	RandomGenerator random;
+	int           playerAge;
+	bool          playerDead;
+	unsigned char rows;
+	unsigned char cols;
+	unsigned char playerRow;
+	unsigned char playerCol;
+	int           nSnakes;
+	unsigned char snakeRows[MAX_COMPACT_SNAKES];
+	unsigned char snakeCols[MAX_COMPACT_SNAKES];
+
+	// Copy the state of a game in pit; return false if the pit has no
+	// player or is too big.
+	bool fromPit(const Pit& pit);
+
+	int  numberOfSnakesAt(int r, int c) const;
+	bool isOver() const;
+	void takeTurn(char action);  // as Pit::takeTurn
+	void destroyOneSnake(int r, int c);
+	void moveSnakes();
+};
+
+// Chooses each action by trying each possible action in nRollouts/5
+// rollouts:  copies of the game (as CompactGameStates) played on for
+// depth turns with random snake moves and a player acting at random,
+// scored by the turns the player survives plus two per snake killed.
+// Pits too big for a CompactGameState are played as GreedyEscapePolicy
+// would.
+class RolloutPolicy : public PlayerPolicy
+{
+public:
+	RolloutPolicy(unsigned long long seed, int nRollouts = 1000, int depth = 30);
+	virtual char chooseAction(const Pit& pit);
+
+	// Statistics about the decisions made so far
+	long long nodes() const;       // turns played in rollouts
+	long long decisions() const;
+	double    seconds() const;     // spent deciding
+	double    longestDecision() const;
+
+private:
+	RandomGenerator    m_random;
+	int                m_nRollouts;
+	int                m_depth;
+	GreedyEscapePolicy m_fallback;
+	long long          m_nodes;
+	long long          m_decisions;
+	double             m_seconds;
+	double             m_longestDecision;
+};
+
+// Where a game played in real time gets the player's keys
+class KeySource
+{
+public:
+	virtual ~KeySource() {}
+
+	// Return the next key pressed, waiting until deadline at the latest
+	// (and returning '\0' if none is pressed by then).  tick is the number
+	// of turns played so far.
+	virtual char nextKey(long long tick, chrono::steady_clock::time_point deadline) = 0;
+};
+
+// Reads keys from the terminal as they are pressed, without waiting for
+// Enter or echoing them; the terminal is put back as it was by the
+// destructor.
+class TerminalKeys : public KeySource
+{
+public:
+	TerminalKeys();
+	virtual ~TerminalKeys();
+	virtual char nextKey(long long tick, chrono::steady_clock::time_point deadline);
+
+private:
+#ifndef _MSC_VER
+	bool    m_rawMode;  // m_savedMode must be restored
+	termios m_savedMode;
+#endif
+};
+
+// Stands in for the keyboard in tests:  a file of lines "TICK KEY", each
+// pressing KEY once TICK turns have been played, in order.  (A space or
+// '.' is a key that stands.)
+class ScriptedKeys : public KeySource
+{
+public:
+	bool load(string path);
+	virtual char nextKey(long long tick, chrono::steady_clock::time_point deadline);
+
+private:
+	vector<long long> m_ticks;
+	string            m_keys;
+	size_t            m_next = 0;
+};
+
+// How a game played by a PlayerPolicy turned out
+struct GameOutcome
+{
+	int  steps;         // turns the player lasted
+	int  snakesKilled;
+	bool won;           // all the snakes were killed
+	bool lost;          // the player died
+};
+
+// A recording of a game:  how it was set up and the player's action on
+// each turn, stored in half a byte, with a snapshot of the whole pit every
+// snapshotInterval turns so that any turn can be reached quickly.
+class ReplayLog
+{
+public:
+	ReplayLog(int snapshotInterval = 4096);
+
+	// Accessors
+	long long turnCount() const;
+	char      action(long long turn) const;  // the action taken on a turn
+	const PitState& finalState() const;
+	bool      save(string path) const;
+
+	// Return a new pit as it was after the given number of turns, playing
+	// on from the latest snapshot before then (or from the start, if
+	// fromStart is true).
+	Pit*      replay(long long turn, bool fromStart = false) const;
+
+	// Mutators
+	void      start(const Pit& pit, unsigned long long seed);
+	void      record(const Pit& pit, char action);  // after the turn
+	void      finish(const Pit& pit);
+	bool      load(string path);
+
+private:
+	int       m_rows;
+	int       m_cols;
+	unsigned long long m_seed;
+	int       m_snapshotInterval;
+	long long m_turns;
+	vector<unsigned char> m_actions;  // two per byte, as ACTION_CODES indexes
+	vector<PitState> m_snapshots;     // after 0, m_snapshotInterval, ... turns
+	PitState  m_final;                // after the last turn
 };
 
 class Game
 {
 public:
 	// Constructor/destructor
-	Game(int rows, int cols, int nSnakes);
+	Game(int rows, int cols, int nSnakes, unsigned long long seed);
 	~Game();
 
 	// Mutators
 	void play();
+	void playRealTime(KeySource& keys, int ticksPerSecond, int framesPerSecond);
+	GameOutcome simulate(PlayerPolicy& policy, long long maxSteps);
+	void record(ReplayLog* log);  // record the rest of the game in log
 
 private:
-	Pit* m_pit;
+	void takeTurn(char action);
+
+	Pit*       m_pit;
+	unsigned long long m_seed;
+	ReplayLog* m_log;
+};
+
+// Lets a number of threads wait until all of them have reached a point
+class Barrier
+{
+public:
+	Barrier(int nThreads);
+	void wait();
+
+private:
+	mutex              m_mutex;
+	condition_variable m_allArrived;
+	int                m_nThreads;
+	int                m_nWaiting;
+	long long          m_generation;
+};
+
+// A rectangle of a TiledPit's positions, and the snakes in it
+struct PitTile
+{
+	int top;    // the first row and column of the tile
+	int left;
+	int nRows;
+	int nCols;
+
+	// Snake k is numbered ids[k] and is at (rows[k],cols[k]).
+	vector<int> rows;
+	vector<int> cols;
+	vector<int> ids;
+	vector<int> nSnakesAt;  // for each of the tile's positions
+
+	// Snakes that moved out of the tile this turn, to be taken in by the
+	// tile they moved into
+	vector<int> outRows;
+	vector<int> outCols;
+	vector<int> outIds;
+
+	bool hitPlayer;         // a snake moved onto the player this turn
+};
+
+// A pit too big for one thread to move all the snakes in quickly.  It is
+// divided into tiles (of tileRows x tileCols positions), each with its own
+// snakes, and moveSnakes shares the tiles out among threads:  they move
+// the snakes within their tiles, wait for each other, then take in the
+// snakes that crossed into their tiles.  Each snake keeps its number for
+// life, and its direction on a turn comes from hashing the seed, that
+// number and the turn, so the game plays out the same however many threads
+// there are, and whatever the size of the tiles.
+class TiledPit
+{
+public:
+	// Constructor
+	TiledPit(int nRows, int nCols, int tileRows, int tileCols,
+		unsigned long long seed);
+	~TiledPit();
+
+	// Accessors
+	int  rows() const;
+	int  cols() const;
+	int  snakeCount() const;
+	int  numberOfSnakesAt(int r, int c) const;
+	int  playerRow() const;
+	int  playerCol() const;
+	bool isPlayerDead() const;
+	unsigned long long checksum() const;  // of the snakes' numbers and positions
+
+	// Mutators
+	bool addSnake(int r, int c);
+	bool addPlayer(int r, int c);
+	bool destroyOneSnake(int r, int c);
+	void movePlayer(int dir);  // as Player::move; -1 to stand
+	bool moveSnakes(int nThreads);
+
+private:
+	TiledPit(const TiledPit&) = delete;
+	TiledPit& operator=(const TiledPit&) = delete;
+
+	int  tileOf(int r, int c) const;
+	int  cellOf(const PitTile& tile, int r, int c) const;
+	void moveTileSnakes(PitTile& tile);
+	void takeMigrants(int t);
+	void startWorkers(int nThreads);
+	void stopWorkers();
+	void workerLoop(int w, long long turnsSeen);
+	void moveOwnedSnakes(int w);
+
+	int    m_rows;
+	int    m_cols;
+	int    m_tileRows;
+	int    m_tileCols;
+	int    m_nTileCols;      // tiles across the pit
+	unsigned long long m_key;
+	long long m_turn;
+	int    m_nextId;
+	int    m_nSnakes;
+	int    m_playerRow;      // 0 if there is no player
+	int    m_playerCol;
+	bool   m_playerDead;
+	vector<PitTile> m_tiles;
+
+	// Worker w (the thread calling moveSnakes is worker 0) owns tiles w,
+	// w + m_nWorkers, and so on.  Workers 1 and up are started by the first
+	// moveSnakes and wait between turns until the pit is destroyed, or
+	// until moveSnakes asks for a different number of threads.
+	int                m_nWorkers;
+	vector<thread>     m_workers;
+	Barrier*           m_barrier;
+	mutex              m_mutex;
+	condition_variable m_turnStarted;
+	condition_variable m_turnFinished;
+	long long          m_turnsStarted;
+	int                m_nBusy;
+	bool               m_stopping;
+};
+
+// A huge pit simulated in less detail away from the player.  The pit is
+// divided into blocks of blockSize x blockSize positions.  The blocks
+// within radius positions, rounded up to whole blocks, of the player's
+// block are exact:  their snakes have positions and move as
+// Pit::moveSnakes moves them.  Every other block
+// just holds the expected number of snakes in it, which a diffusion step
+// spreads to its neighbors each turn at the rate snakes walking at random
+// would cross between them.  As the player approaches a block, its snakes
+// are given random positions in it (the number rounded at random, keeping
+// its expectation); blocks the player has left far behind give up their
+// snakes' positions again.  Snakes walking out of the exact blocks join
+// the density of the block they walk into, and density flowing into an
+// exact block becomes snakes on its edge.  The player can only meet exact
+// snakes, and a game plays out like the exact game in distribution, not
+// move for move.
+class LodPit
+{
+public:
+	// Constructor
+	LodPit(int nRows, int nCols, int blockSize, int radius, unsigned long long seed);
+
+	// Accessors
+	int    rows() const;
+	int    cols() const;
+	double snakeCount() const;       // exact snakes plus the expected rest
+	int    exactSnakeCount() const;
+	int    numberOfSnakesAt(int r, int c) const;  // 0 away from the player
+	int    playerRow() const;
+	int    playerCol() const;
+	bool   isPlayerDead() const;
+
+	// Mutators
+	bool   addSnake(int r, int c);
+	bool   addPlayer(int r, int c);
+	bool   takeTurn(char action);   // as Pit::takeTurn
+
+private:
+	int    blockOf(int r, int c) const;
+	int    cell(int r, int c) const;
+	void   destroyOneSnake(int r, int c);
+	void   addExactSnake(int r, int c);
+	void   removeExactSnake(int k);
+	void   materialize(int b, double expected, int fromDir);
+	void   updateZone();
+	void   moveExactSnakes();
+	void   diffuse();
+
+	int    m_rows;
+	int    m_cols;
+	int    m_blockSize;
+	int    m_nBlockRows;
+	int    m_nBlockCols;
+	int    m_radius;            // in blocks
+	RandomGenerator m_random;
+	int    m_playerRow;         // 0 if there is no player
+	int    m_playerCol;
+	bool   m_playerDead;
+
+	// The exact snakes, and the number at each position
+	vector<int> m_snakeRows;
+	vector<int> m_snakeCols;
+	vector<int> m_nSnakesAt;
+
+	// For each block, whether it's exact and, if not, its expected number
+	// of snakes
+	vector<char>   m_isExact;
+	vector<int>    m_exactBlocks;
+	vector<double> m_density;
+	vector<double> m_nextDensity;  // scratch space for diffuse
 };
 
 ///////////////////////////////////////////////////////////////////////////
-//  Snake implementation
+//  Profiler implementation
 ///////////////////////////////////////////////////////////////////////////
 
-Snake::Snake(Pit* pp, int r, int c)
+#ifdef SNAKE_PROFILE
+
+TimeHistogram::TimeHistogram()
+	: m_count(0), m_total(0), m_maximum(0)
 {
-	if (pp == nullptr)
-	{
-		cout << "***** A snake must be in some Pit!" << endl;
-		exit(1);
-	}
-	if (r < 1 || r > pp->rows() || c < 1 || c > pp->cols())
+	for (int b = 0; b < N_BUCKETS; b++)
+		m_buckets[b] = 0;
+}
+
+// The bucket for ns:  the position of its top bit, then the next three bits
+int TimeHistogram::bucketOf(long long ns)
+{
+	unsigned long long v = (ns > 0 ? ns : 0);
+	if (v < SUB_BUCKETS)
+		return static_cast<int>(v);
+	int top = 63;
+	while ((v >> top) == 0)
+		top--;
+	return (top - 2) * SUB_BUCKETS + static_cast<int>((v >> (top - 3)) & (SUB_BUCKETS - 1));
+}
+
+// The largest time in bucket b
+long long TimeHistogram::bucketTop(int b)
+{
+	if (b < SUB_BUCKETS)
+		return b;
+	int top = b / SUB_BUCKETS + 2;
+	long long first = (static_cast<long long>(SUB_BUCKETS + b % SUB_BUCKETS)) << (top - 3);
+	return first + (1LL << (top - 3)) - 1;
+}
+
+void TimeHistogram::add(long long ns)
+{
+	m_buckets[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+	m_count.fetch_add(1, memory_order_relaxed);
+	m_total.fetch_add(ns, memory_order_relaxed);
+	long long max = m_maximum.load(memory_order_relaxed);
+	while (ns > max && !m_maximum.compare_exchange_weak(max, ns, memory_order_relaxed))
+		;
+}
+
+long long TimeHistogram::count() const
+{
+	return m_count;
+}
+
+long long TimeHistogram::total() const
+{
+	return m_total;
+}
+
+long long TimeHistogram::maximum() const
+{
+	return m_maximum;
+}
+
+long long TimeHistogram::percentile(double p) const
+{
+	long long n = m_count;
+	if (n == 0)
+		return 0;
+	long long rank = static_cast<long long>(p / 100 * n + 0.5);
+	if (rank < 1)
+		rank = 1;
+	long long seen = 0;
+	for (int b = 0; b < N_BUCKETS; b++)
 	{
-		cout << "***** Snake created with invalid coordinates (" << r << ","
-			<< c << ")!" << endl;
-		exit(1);
+		seen += m_buckets[b];
+		if (seen >= rank)
+			return min(bucketTop(b), maximum());
 	}
-	m_pit = pp;
-	m_row = r;
-	m_col = c;
+	return maximum();
 }
 
-int Snake::row() const
+void Profiler::addTime(ProfileSection section, long long ns)
 {
-	return m_row;
+	m_times[section].add(ns);
 }
 
-int Snake::col() const
+void Profiler::count(ProfileCounter counter, long long n)
 {
-	return m_col;
+	m_counters[counter].fetch_add(n, memory_order_relaxed);
 }
 
-void Snake::move()
+bool Profiler::write(string path) const
 {
-	// Attempt to move in a random direction; if we can't move, don't move
-	switch (rand() % 4)
+	const char* SECTION_NAMES[N_PROFILE_SECTIONS] = {
+		"tick", "player_move", "move_snakes", "display", "input"
+	};
+	const char* COUNTER_NAMES[N_PROFILE_COUNTERS] = {
+		"snake_queries", "snakes_moved", "snakes_destroyed", "frame_bytes"
+	};
+	ofstream file(path.c_str());
+	file << "{\n  \"sections\": {";
+	for (int s = 0; s < N_PROFILE_SECTIONS; s++)
 	{
-	case UP:     if (m_row > 1)             m_row--; break;
-	case DOWN:   if (m_row < m_pit->rows()) m_row++; break;
-	case LEFT:   if (m_col > 1)             m_col--; break;
-	case RIGHT:  if (m_col < m_pit->cols()) m_col++; break;
+		const TimeHistogram& h = m_times[s];
+		file << (s == 0 ? "\n" : ",\n") << "    \"" << SECTION_NAMES[s] << "\": {"
+			<< "\"count\": " << h.count() << ", \"total_ns\": " << h.total()
+			<< ", \"mean_ns\": " << (h.count() == 0 ? 0 : h.total() / h.count())
+			<< ", \"p50_ns\": " << h.percentile(50) << ", \"p99_ns\": " << h.percentile(99)
+			<< ", \"max_ns\": " << h.maximum() << "}";
 	}
+	file << "\n  },\n  \"counters\": {";
+	for (int c = 0; c < N_PROFILE_COUNTERS; c++)
+		file << (c == 0 ? "\n" : ",\n") << "    \"" << COUNTER_NAMES[c] << "\": "
+			<< m_counters[c];
+	file << "\n  }\n}\n";
+	return file.good();
+}
+
+Profiler& profiler()
+{
+	static Profiler theProfiler;
+	return theProfiler;
+}
+
+ScopedTimer::ScopedTimer(ProfileSection section)
+	: m_section(section), m_start(chrono::steady_clock::now())
+{
 }
 
+ScopedTimer::~ScopedTimer()
+{
+	profiler().addTime(m_section, chrono::duration_cast<chrono::nanoseconds>(
+		chrono::steady_clock::now() - m_start).count());
+}
+
+#endif
+
 ///////////////////////////////////////////////////////////////////////////
-//  Player implementations
+//  RandomGenerator implementation
 ///////////////////////////////////////////////////////////////////////////
 
-Player::Player(Pit* pp, int r, int c)
+// Scramble x (the SplitMix64 finalizer).  Used to turn one seed into
+// several unrelated ones.
+unsigned long long mixSeed(unsigned long long x)
 {
-	if (pp == nullptr)
-	{
-		cout << "***** The player must be in some Pit!" << endl;
-		exit(1);
-	}
-	if (r < 1 || r > pp->rows() || c < 1 || c > pp->cols())
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+RandomGenerator::RandomGenerator(unsigned long long seed)
+{
+	// xoshiro's state must not be all zero; SplitMix64 output never is
+	// for four consecutive values.
+	for (int k = 0; k < 4; k++)
 	{
-		cout << "**** Player created with invalid coordinates (" << r
-			<< "," << c << ")!" << endl;
-		exit(1);
+		seed = mixSeed(seed);
+		m_state[k] = seed;
 	}
-	m_pit = pp;
-	m_row = r;
-	m_col = c;
-	m_age = 0;
-	m_dead = false;
 }
 
-int Player::row() const
+unsigned long long RandomGenerator::next()
 {
-	return m_row;
+	unsigned long long* s = m_state;
+	unsigned long long x = s[1] * 5;
+	unsigned long long result = ((x << 7) | (x >> 57)) * 9;
+	unsigned long long t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+	return result;
 }
 
-int Player::col() const
+int RandomGenerator::below(int n)
 {
-	return m_col;
+	// Scale the top 32 bits into range, rather than divide
+	return static_cast<int>(((next() >> 32) * static_cast<unsigned long long>(n)) >> 32);
 }
 
-int Player::age() const
+void RandomGenerator::getState(unsigned long long state[4]) const
 {
-	return m_age;
+	for (int k = 0; k < 4; k++)
+		state[k] = m_state[k];
 }
 
-void Player::stand()
+void RandomGenerator::setState(const unsigned long long state[4])
 {
-	m_age++;
+	for (int k = 0; k < 4; k++)
+		m_state[k] = state[k];
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  TerminalRenderer implementation
+///////////////////////////////////////////////////////////////////////////
+
+TerminalRenderer::TerminalRenderer()
+{
+#ifdef _MSC_VER
+	m_redrawAll = true;
+#else
+	// The same test clearScreen makes
+	const char* term = getenv("TERM");
+	m_redrawAll = (term == nullptr || strcmp(term, "dumb") == 0);
+#endif
+}
+
+void TerminalRenderer::reset()
+{
+	m_previous.clear();
+}
+
+// Append the escape sequence that moves the cursor to row r, column c
+// (numbered from 1).
+void moveCursor(string& frame, int r, int c)
+{
+	frame += "\x1B[" + to_string(r) + ";" + to_string(c) + "H";
+}
+
+void TerminalRenderer::compose(const vector<string>& grid, const string& status,
+	string& frame)
+{
+	frame.clear();
+	bool sameShape = !m_redrawAll && m_previous.size() == grid.size();
+	for (size_t r = 0; sameShape && r < grid.size(); r++)
+		if (m_previous[r].size() != grid[r].size())
+			sameShape = false;
+
+	if (!sameShape)
+	{
+		// Draw everything
+		if (!m_redrawAll)
+			frame += "\x1B[2J\x1B[H";
+		for (size_t r = 0; r < grid.size(); r++)
+			frame += grid[r] + "\n";
+	}
+	else
+	{
+		// Rewrite each run of changed cells in place.  Unchanged cells
+		// between two changes are rewritten too when that is no longer
+		// than the escape sequence that would move the cursor past them.
+		for (size_t r = 0; r < grid.size(); r++)
+		{
+			const string& now = grid[r];
+			const string& before = m_previous[r];
+			size_t maxGap = 4 + to_string(r + 1).size() + to_string(now.size()).size();
+			size_t c = 0;
+			while (c < now.size())
+			{
+				if (now[c] == before[c])
+				{
+					c++;
+					continue;
+				}
+				size_t end = c + 1;
+				for (size_t next = end; next < now.size() && next <= end + maxGap; next++)
+					if (now[next] != before[next])
+						end = next + 1;
+				moveCursor(frame, static_cast<int>(r) + 1, static_cast<int>(c) + 1);
+				frame.append(now, c, end - c);
+				c = end;
+			}
+		}
+
+		// Clear everything below the grid
+		moveCursor(frame, static_cast<int>(grid.size()) + 1, 1);
+		frame += "\x1B[J";
+
+		// When most of the grid changed, writing all of it over the last
+		// frame is shorter.
+		size_t gridSize = 0;
+		for (size_t r = 0; r < grid.size(); r++)
+			gridSize += grid[r].size() + 1;
+		if (frame.size() > gridSize + 6)
+		{
+			frame = "\x1B[H";
+			for (size_t r = 0; r < grid.size(); r++)
+				frame += grid[r] + "\n";
+			frame += "\x1B[J";
+		}
+	}
+	frame += "\n\n";
+	frame += status;
+	m_previous = grid;
+}
+
+void TerminalRenderer::draw(const vector<string>& grid, const string& status)
+{
+	compose(grid, status, m_frame);
+	PROFILE_COUNT(PROFILE_FRAME_BYTES, m_frame.size());
+	if (m_redrawAll)
+		clearScreen();
+	cout.flush();
+#ifdef _MSC_VER
+	cout << m_frame << flush;
+#else
+	for (size_t written = 0; written < m_frame.size(); )
+	{
+		ssize_t n = write(STDOUT_FILENO, m_frame.data() + written,
+			m_frame.size() - written);
+		if (n <= 0)
+			break;
+		written += n;
+	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Snake implementation
+///////////////////////////////////////////////////////////////////////////
+
+Snake::Snake(Pit* pp, int k)
+{
+	if (pp == nullptr)
+	{
+		cout << "***** A snake must be in some Pit!" << endl;
+		exit(1);
+	}
+	m_pit = pp;
+	m_index = k;
+}
+
+int Snake::row() const
+{
+	return m_pit->m_snakeRows[m_index];
+}
+
+int Snake::col() const
+{
+	return m_pit->m_snakeCols[m_index];
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Player implementations
+///////////////////////////////////////////////////////////////////////////
+
+Player::Player(Pit* pp, int r, int c)
+{
+	if (pp == nullptr)
+	{
+		cout << "***** The player must be in some Pit!" << endl;
+		exit(1);
+	}
+	if (r < 1 || r > pp->rows() || c < 1 || c > pp->cols())
+	{
+		cout << "**** Player created with invalid coordinates (" << r
+			<< "," << c << ")!" << endl;
+		exit(1);
+	}
+	m_pit = pp;
+	m_row = r;
+	m_col = c;
+	m_age = 0;
+	m_dead = false;
+}
+
+int Player::row() const
+{
+	return m_row;
+}
+
+int Player::col() const
+{
+	return m_col;
+}
+
+int Player::age() const
+{
+	return m_age;
+}
+
+void Player::stand()
+{
+	m_age++;
 }
 
 void Player::move(int dir)
 {
+	ALLOCATION_SCOPE("Player::move");
+	PROFILE_SCOPE(PROFILE_PLAYER_MOVE);
 	m_age++;
 	int maxCanMove = 0;  // maximum distance player can move in direction dir
 	switch (dir)
@@ -256,13 +1149,24 @@ void Player::setDead()
 	m_dead = true;
 }
 
+// Put the player back as it was at some point in a game
+void Player::restore(int r, int c, int age, bool dead)
+{
+	m_row = r;
+	m_col = c;
+	m_age = age;
+	m_dead = dead;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 //  Pit implementations
 ///////////////////////////////////////////////////////////////////////////
 
-Pit::Pit(int nRows, int nCols)
+Pit::Pit(int nRows, int nCols, unsigned long long seed)
+	: m_random(seed), m_scanForSnakes(false)
 {
-	if (nRows <= 0 || nCols <= 0 || nRows > MAXROWS || nCols > MAXCOLS)
+	ALLOCATION_SCOPE("Pit::Pit");
+	if (nRows <= 0 || nCols <= 0)
 	{
 		cout << "***** Pit created with invalid size " << nRows << " by "
 			<< nCols << "!" << endl;
@@ -271,13 +1175,12 @@ Pit::Pit(int nRows, int nCols)
 	m_rows = nRows;
 	m_cols = nCols;
 	m_player = nullptr;
-	m_nSnakes = 0;
+	m_nSnakesAt.assign(static_cast<size_t>(nRows) * nCols, 0);
+	m_firstSnakeAt.assign(static_cast<size_t>(nRows) * nCols, -1);
 }
 
 Pit::~Pit()
 {
-	for (int k = 0; k < m_nSnakes; k++)
-		delete m_snakes[k];
 	delete m_player;
 }
 
@@ -296,40 +1199,55 @@ Player* Pit::player() const
 	return m_player;
 }
 
+RandomGenerator& Pit::random()
+{
+	return m_random;
+}
+
 int Pit::snakeCount() const
 {
-	return m_nSnakes;
+	return static_cast<int>(m_snakeRows.size());
+}
+
+Snake Pit::snake(int k)
+{
+	return Snake(this, k);
+}
+
+// The index in the occupancy grid of position (r,c)
+int Pit::cell(int r, int c) const
+{
+	return (r - 1) * m_cols + (c - 1);
 }
 
 int Pit::numberOfSnakesAt(int r, int c) const
 {
-	int count = 0;
-	for (int k = 0; k < m_nSnakes; k++)
+	PROFILE_COUNT(PROFILE_SNAKE_QUERIES, 1);
+	if (m_scanForSnakes)
 	{
-		const Snake* sp = m_snakes[k];
-		if (sp->row() == r  &&  sp->col() == c)
-			count++;
+		int count = 0;
+		for (int k = 0; k < snakeCount(); k++)
+			if (m_snakeRows[k] == r  &&  m_snakeCols[k] == c)
+				count++;
+		return count;
 	}
-	return count;
+	if (r < 1 || r > m_rows || c < 1 || c > m_cols)
+		return 0;
+	return m_nSnakesAt[cell(r, c)];
 }
 
-void Pit::display(string msg) const
+// The pit as rows of characters:  position (row,col) in the pit coordinate
+// system is represented in the element grid[row-1][col-1]
+vector<string> Pit::picture() const
 {
-	// Position (row,col) in the pit coordinate system is represented in
-	// the array element grid[row-1][col-1]
-	char grid[MAXROWS][MAXCOLS];
-	int r, c;
-
+	ALLOCATION_SCOPE("Pit::picture");
 	// Fill the grid with dots
-	for (r = 0; r < rows(); r++)
-		for (c = 0; c < cols(); c++)
-			grid[r][c] = '.';
+	vector<string> grid(rows(), string(cols(), '.'));
 
 	// Indicate each snake's position
-	for (int k = 0; k < m_nSnakes; k++)
+	for (int k = 0; k < snakeCount(); k++)
 	{
-		const Snake* sp = m_snakes[k];
-		char& gridChar = grid[sp->row() - 1][sp->col() - 1];
+		char& gridChar = grid[m_snakeRows[k] - 1][m_snakeCols[k] - 1];
 		switch (gridChar)
 		{
 		case '.':  gridChar = 'S'; break;
@@ -348,45 +1266,66 @@ void Pit::display(string msg) const
 		else
 			gridChar = '@';
 	}
+	return grid;
+}
 
-	// Draw the grid
-	clearScreen();
-	for (r = 0; r < rows(); r++)
-	{
-		for (c = 0; c < cols(); c++)
-			cout << grid[r][c];
-		cout << endl;
-	}
-	cout << endl;
-
-	// Write message, snake, and player info
-	cout << endl;
+// The lines written below the picture:  the message, snake, and player info
+string Pit::status(string msg) const
+{
+	ALLOCATION_SCOPE("Pit::status");
+	string lines;
 	if (msg != "")
-		cout << msg << endl;
-	cout << "There are " << snakeCount() << " snakes remaining." << endl;
+		lines += msg + "\n";
+	lines += "There are " + to_string(snakeCount()) + " snakes remaining.\n";
 	if (m_player == nullptr)
-		cout << "There is no player." << endl;
+		lines += "There is no player.\n";
 	else
 	{
 		if (m_player->age() > 0)
-			cout << "The player has lasted " << m_player->age() << " steps." << endl;
+			lines += "The player has lasted " + to_string(m_player->age()) + " steps.\n";
 		if (m_player->isDead())
-			cout << "The player is dead." << endl;
+			lines += "The player is dead.\n";
 	}
+	return lines;
+}
+
+// The renderer for the terminal
+TerminalRenderer& terminal()
+{
+	static TerminalRenderer renderer;
+	return renderer;
+}
+
+void Pit::display(string msg) const
+{
+	ALLOCATION_SCOPE("Pit::display");
+	PROFILE_SCOPE(PROFILE_DISPLAY);
+	terminal().draw(picture(), status(msg));
 }
 
 bool Pit::addSnake(int r, int c)
 {
-	// Dynamically allocate a new Snake and add it to the pit
-	if (m_nSnakes == MAXSNAKES)
-		return false;
-	m_snakes[m_nSnakes] = new Snake(this, r, c);
-	m_nSnakes++;
+	ALLOCATION_SCOPE("Pit::addSnake");
+	if (r < 1 || r > m_rows || c < 1 || c > m_cols)
+	{
+		cout << "***** Snake created with invalid coordinates (" << r << ","
+			<< c << ")!" << endl;
+		exit(1);
+	}
+
+	// Add a new snake to the end of the arrays
+	m_snakeRows.push_back(r);
+	m_snakeCols.push_back(c);
+	m_nextSnake.push_back(-1);
+	m_prevSnake.push_back(-1);
+	if (!m_scanForSnakes)
+		linkSnake(snakeCount() - 1);
 	return true;
 }
 
 bool Pit::addPlayer(int r, int c)
 {
+	ALLOCATION_SCOPE("Pit::addPlayer");
 	// Don't add a player if one already exists
 	if (m_player != nullptr)
 		return false;
@@ -398,59 +1337,332 @@ bool Pit::addPlayer(int r, int c)
 
 bool Pit::destroyOneSnake(int r, int c)
 {
-	for (int k = 0; k < m_nSnakes; k++)
+	// Destroy the snake at this position that comes first in the arrays,
+	// so that the remaining snakes keep the order (and so the moves) they
+	// would have had if we had searched the arrays from the start.
+	int k = 0;
+	if (m_scanForSnakes)
+	{
+		while (k < snakeCount() && (m_snakeRows[k] != r || m_snakeCols[k] != c))
+			k++;
+		if (k == snakeCount())
+			return false;
+	}
+	else
+	{
+		if (numberOfSnakesAt(r, c) == 0)
+			return false;
+		k = m_firstSnakeAt[cell(r, c)];
+		for (int other = m_nextSnake[k]; other != -1; other = m_nextSnake[other])
+			if (other < k)
+				k = other;
+		unlinkSnake(k, r, c);
+	}
+	PROFILE_COUNT(PROFILE_SNAKES_DESTROYED, 1);
+
+	int last = snakeCount() - 1;
+	if (k != last)
 	{
-		if (m_snakes[k]->row() == r  &&  m_snakes[k]->col() == c)
+		// Move the last snake into position k, along with its place in
+		// its position's list.
+		m_snakeRows[k] = m_snakeRows[last];
+		m_snakeCols[k] = m_snakeCols[last];
+		if (!m_scanForSnakes)
 		{
-			delete m_snakes[k];
-			m_snakes[k] = m_snakes[m_nSnakes - 1];
-			m_nSnakes--;
-			return true;
+			m_nextSnake[k] = m_nextSnake[last];
+			m_prevSnake[k] = m_prevSnake[last];
+			if (m_prevSnake[k] == -1)
+				m_firstSnakeAt[cell(m_snakeRows[k], m_snakeCols[k])] = k;
+			else
+				m_nextSnake[m_prevSnake[k]] = k;
+			if (m_nextSnake[k] != -1)
+				m_prevSnake[m_nextSnake[k]] = k;
 		}
 	}
-	return false;
+	m_snakeRows.pop_back();
+	m_snakeCols.pop_back();
+	m_nextSnake.pop_back();
+	m_prevSnake.pop_back();
+	return true;
+}
+
+// Add snake k to the list for its position.
+void Pit::linkSnake(int k)
+{
+	int at = cell(m_snakeRows[k], m_snakeCols[k]);
+	m_nSnakesAt[at]++;
+	m_prevSnake[k] = -1;
+	m_nextSnake[k] = m_firstSnakeAt[at];
+	if (m_nextSnake[k] != -1)
+		m_prevSnake[m_nextSnake[k]] = k;
+	m_firstSnakeAt[at] = k;
+}
+
+// Remove snake k from the list for position (r,c), where it was.
+void Pit::unlinkSnake(int k, int r, int c)
+{
+	int at = cell(r, c);
+	m_nSnakesAt[at]--;
+	if (m_prevSnake[k] == -1)
+		m_firstSnakeAt[at] = m_nextSnake[k];
+	else
+		m_nextSnake[m_prevSnake[k]] = m_nextSnake[k];
+	if (m_nextSnake[k] != -1)
+		m_prevSnake[m_nextSnake[k]] = m_prevSnake[k];
 }
 
 bool Pit::moveSnakes()
 {
-	for (int k = 0; k < m_nSnakes; k++)
+	ALLOCATION_SCOPE("Pit::moveSnakes");
+	PROFILE_SCOPE(PROFILE_MOVE_SNAKES);
+
+	// Draw every snake's direction at once, two bits each, then move them
+	// all (see stepSnakes).
+	int n = snakeCount();
+	PROFILE_COUNT(PROFILE_SNAKES_MOVED, n);
+	m_directionBits.resize((n + 31) / 32);
+	for (size_t w = 0; w < m_directionBits.size(); w++)
+		m_directionBits[w] = m_random.next();
+	m_moves.resize(n);
+	if (stepSnakes(m_snakeRows.data(), m_snakeCols.data(), m_directionBits.data(),
+			m_moves.data(), n, m_rows, m_cols, m_player->row(), m_player->col()))
+		m_player->setDead();
+
+	// Keep the occupancy grid up to date
+	if (!m_scanForSnakes)
 	{
-		Snake* sp = m_snakes[k];
-		sp->move();
-		if (sp->row() == m_player->row() && sp->col() == m_player->col())
-			m_player->setDead();
+		for (int k = 0; k < n; k++)
+		{
+			int rowDelta;
+			int colDelta;
+			if (directionToDeltas(m_moves[k], rowDelta, colDelta))
+			{
+				unlinkSnake(k, m_snakeRows[k] - rowDelta, m_snakeCols[k] - colDelta);
+				linkSnake(k);
+			}
+		}
 	}
 
 	// return true if the player is still alive, false otherwise
 	return !m_player->isDead();
 }
 
+// Play a turn:  the player takes the action ('u', 'd', 'l' or 'r' to
+// move, anything else to stand), then the snakes move.  Return true if
+// the player is still alive.
+bool Pit::takeTurn(char action)
+{
+	ALLOCATION_SCOPE("Pit::takeTurn");
+	PROFILE_SCOPE(PROFILE_TICK);
+	int dir = decodeDirection(action);
+	if (dir == -1)
+		m_player->stand();
+	else
+		m_player->move(dir);
+	return moveSnakes();
+}
+
+void Pit::saveState(PitState& state) const
+{
+	m_random.getState(state.random);
+	state.playerRow = 0;
+	state.playerCol = 0;
+	state.playerAge = 0;
+	state.playerDead = false;
+	if (m_player != nullptr)
+	{
+		state.playerRow = m_player->row();
+		state.playerCol = m_player->col();
+		state.playerAge = m_player->age();
+		state.playerDead = m_player->isDead();
+	}
+	state.snakeRows = m_snakeRows;
+	state.snakeCols = m_snakeCols;
+}
+
+// Put the pit back as it was when state was saved (it must be the same
+// size).
+void Pit::restoreState(const PitState& state)
+{
+	m_random.setState(state.random);
+	if (state.playerRow == 0)
+	{
+		delete m_player;
+		m_player = nullptr;
+	}
+	else
+	{
+		if (m_player == nullptr)
+			m_player = new Player(this, state.playerRow, state.playerCol);
+		m_player->restore(state.playerRow, state.playerCol, state.playerAge,
+			state.playerDead);
+	}
+
+	m_snakeRows = state.snakeRows;
+	m_snakeCols = state.snakeCols;
+	relinkSnakes();
+}
+
+void Pit::setScanForSnakes(bool scan)
+{
+	m_scanForSnakes = scan;
+	relinkSnakes();
+}
+
+// Rebuild the occupancy grid from the snakes' positions (leaving it empty
+// if it isn't being kept).
+void Pit::relinkSnakes()
+{
+	m_nSnakesAt.assign(m_nSnakesAt.size(), 0);
+	m_firstSnakeAt.assign(m_firstSnakeAt.size(), -1);
+	m_nextSnake.assign(m_snakeRows.size(), -1);
+	m_prevSnake.assign(m_snakeRows.size(), -1);
+	if (m_scanForSnakes)
+		return;
+	for (int k = 0; k < snakeCount(); k++)
+		linkSnake(k);
+}
+
+bool PitState::operator==(const PitState& other) const
+{
+	for (int k = 0; k < 4; k++)
+		if (random[k] != other.random[k])
+			return false;
+	return playerRow == other.playerRow && playerCol == other.playerCol &&
+		playerAge == other.playerAge && playerDead == other.playerDead &&
+		snakeRows == other.snakeRows && snakeCols == other.snakeCols;
+}
+
 ///////////////////////////////////////////////////////////////////////////
-//  Game implementations
+//  CompactGameState implementation
 ///////////////////////////////////////////////////////////////////////////
 
-Game::Game(int rows, int cols, int nSnakes)
+static_assert(is_trivially_copyable<CompactGameState>::value,
+	"a CompactGameState must be copyable as a block of memory");
+
+bool CompactGameState::fromPit(const Pit& pit)
 {
-	if (nSnakes > MAXSNAKES)
+	if (pit.player() == nullptr || pit.rows() > MAX_COMPACT_SIZE ||
+		pit.cols() > MAX_COMPACT_SIZE || pit.snakeCount() > MAX_COMPACT_SNAKES)
+		return false;
+	PitState state;
+	pit.saveState(state);
+	random.setState(state.random);
+	playerAge = state.playerAge;
+	playerDead = state.playerDead;
+	rows = static_cast<unsigned char>(pit.rows());
+	cols = static_cast<unsigned char>(pit.cols());
+	playerRow = static_cast<unsigned char>(state.playerRow);
+	playerCol = static_cast<unsigned char>(state.playerCol);
+	nSnakes = pit.snakeCount();
+	for (int k = 0; k < nSnakes; k++)
 	{
-		cout << "***** Trying to create Game with " << nSnakes
-			<< " snakes; only " << MAXSNAKES << " are allowed!" << endl;
-		exit(1);
+		snakeRows[k] = static_cast<unsigned char>(state.snakeRows[k]);
+		snakeCols[k] = static_cast<unsigned char>(state.snakeCols[k]);
+	}
+	return true;
+}
+
+int CompactGameState::numberOfSnakesAt(int r, int c) const
+{
+	int count = 0;
+	for (int k = 0; k < nSnakes; k++)
+		if (snakeRows[k] == r && snakeCols[k] == c)
+			count++;
+	return count;
+}
+
+bool CompactGameState::isOver() const
+{
+	return playerDead || nSnakes == 0;
+}
+
+void CompactGameState::takeTurn(char action)
+{
+	// Move the player as Player::move does
+	playerAge++;
+	int rowDelta;
+	int colDelta;
+	if (directionToDeltas(decodeDirection(action), rowDelta, colDelta))
+	{
+		int r1 = playerRow + rowDelta;
+		int c1 = playerCol + colDelta;
+		int r2 = r1 + rowDelta;
+		int c2 = c1 + colDelta;
+		bool againstWall = (r1 < 1 || r1 > rows || c1 < 1 || c1 > cols);
+		if (!againstWall && numberOfSnakesAt(r1, c1) == 0)
+		{
+			playerRow = static_cast<unsigned char>(r1);
+			playerCol = static_cast<unsigned char>(c1);
+		}
+		else if (!againstWall && r2 >= 1 && r2 <= rows && c2 >= 1 && c2 <= cols)
+		{
+			destroyOneSnake(r1, c1);
+			playerRow = static_cast<unsigned char>(r2);
+			playerCol = static_cast<unsigned char>(c2);
+			if (numberOfSnakesAt(r2, c2) > 0)  // landed on a snake!
+				playerDead = true;
+		}
+	}
+	moveSnakes();
+}
+
+// As Pit::destroyOneSnake:  remove the first snake at (r,c), moving the
+// last into its place.
+void CompactGameState::destroyOneSnake(int r, int c)
+{
+	for (int k = 0; k < nSnakes; k++)
+		if (snakeRows[k] == r && snakeCols[k] == c)
+		{
+			nSnakes--;
+			snakeRows[k] = snakeRows[nSnakes];
+			snakeCols[k] = snakeCols[nSnakes];
+			return;
+		}
+}
+
+// As Pit::moveSnakes and stepSnakes
+void CompactGameState::moveSnakes()
+{
+	unsigned long long bits = 0;
+	for (int k = 0; k < nSnakes; k++)
+	{
+		if (k % 32 == 0)
+			bits = random.next();
+		switch ((bits >> (2 * (k % 32))) & 3)
+		{
+		case UP:     if (snakeRows[k] > 1)    snakeRows[k]--; break;
+		case DOWN:   if (snakeRows[k] < rows) snakeRows[k]++; break;
+		case LEFT:   if (snakeCols[k] > 1)    snakeCols[k]--; break;
+		case RIGHT:  if (snakeCols[k] < cols) snakeCols[k]++; break;
+		}
+		if (snakeRows[k] == playerRow && snakeCols[k] == playerCol)
+			playerDead = true;
 	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Game implementations
+///////////////////////////////////////////////////////////////////////////
 
+Game::Game(int rows, int cols, int nSnakes, unsigned long long seed)
+	: m_seed(seed), m_log(nullptr)
+{
+	ALLOCATION_SCOPE("Game::Game");
 	// Create pit
-	m_pit = new Pit(rows, cols);
+	m_pit = new Pit(rows, cols, seed);
+	RandomGenerator& random = m_pit->random();
 
 	// Add player
-	int rPlayer = 1 + rand() % rows;
-	int cPlayer = 1 + rand() % cols;
+	int rPlayer = 1 + random.below(rows);
+	int cPlayer = 1 + random.below(cols);
 	m_pit->addPlayer(rPlayer, cPlayer);
 
 	// Populate with snakes
 	while (nSnakes > 0)
 	{
-		int r = 1 + rand() % rows;
-		int c = 1 + rand() % cols;
+		int r = 1 + random.below(rows);
+		int c = 1 + random.below(cols);
 		// Don't put a snake where the player is
 		if (r == rPlayer  &&  c == cPlayer)
 			continue;
@@ -466,6 +1678,7 @@ Game::~Game()
 
 void Game::play()
 {
+	ALLOCATION_SCOPE("Game::play");
 	Player* p = m_pit->player();
 	if (p == nullptr)
 	{
@@ -480,10 +1693,11 @@ void Game::play()
 		cout << endl;
 		cout << "Move (u/d/l/r//q): ";
 		string action;
-		getline(cin, action);
-		if (action.size() == 0)
-			p->stand();
-		else
+		{
+			PROFILE_SCOPE(PROFILE_INPUT);
+			getline(cin, action);
+		}
+		if (action.size() != 0)
 		{
 			switch (action[0])
 			{
@@ -491,32 +1705,1408 @@ void Game::play()
 				cout << '\a' << endl;  // beep
 				continue;
 			case 'q':
+				if (m_log != nullptr)
+					m_log->finish(*m_pit);
 				return;
 			case 'u':
 			case 'd':
 			case 'l':
 			case 'r':
-				p->move(decodeDirection(action[0]));
 				break;
 			}
 		}
-		m_pit->moveSnakes();
+		takeTurn(action.size() == 0 ? ' ' : action[0]);
 	} while (!m_pit->player()->isDead() && m_pit->snakeCount() > 0);
+	if (m_log != nullptr)
+		m_log->finish(*m_pit);
 	m_pit->display(msg);
 }
 
-///////////////////////////////////////////////////////////////////////////
-//  Auxiliary function implementation
-///////////////////////////////////////////////////////////////////////////
-
-int decodeDirection(char dir)
+// Play the game in real time:  the snakes move ticksPerSecond times a
+// second whether or not the player acts, taking the player's keys as
+// they come (one a turn; 'q' quits), and the pit is redrawn when it
+// changes, at most framesPerSecond times a second.  At the end, report
+// how long it took for a key to show on the screen.
+void Game::playRealTime(KeySource& keys, int ticksPerSecond, int framesPerSecond)
 {
-	switch (dir)
+	ALLOCATION_SCOPE("Game::playRealTime");
+	typedef chrono::steady_clock Clock;
+	Player* p = m_pit->player();
+	if (p == nullptr)
 	{
-	case 'u':  return UP;
-	case 'd':  return DOWN;
-	case 'l':  return LEFT;
-	case 'r':  return RIGHT;
+		m_pit->display("");
+		return;
+	}
+	Clock::duration tickPeriod = chrono::duration_cast<Clock::duration>(
+		chrono::duration<double>(1.0 / max(ticksPerSecond, 1)));
+	Clock::duration framePeriod = chrono::duration_cast<Clock::duration>(
+		chrono::duration<double>(1.0 / max(framesPerSecond, 1)));
+
+	string pending;                       // keys not yet acted on
+	vector<Clock::time_point> pressed;    //   and when they were pressed
+	vector<Clock::time_point> applied;    // when keys acted on were pressed,
+	                                      //   until the next frame shows them
+	vector<double> latencies;             // seconds from key to frame
+	long long tick = 0;
+	bool changed = true;
+	bool quit = false;
+	Clock::time_point nextTick = Clock::now() + tickPeriod;
+	Clock::time_point nextFrame = Clock::now();
+	while (!quit && !p->isDead() && m_pit->snakeCount() > 0)
+	{
+		if (changed && Clock::now() >= nextFrame)
+		{
+			m_pit->display("");
+			Clock::time_point shown = Clock::now();
+			for (size_t k = 0; k < applied.size(); k++)
+				latencies.push_back(chrono::duration<double>(shown - applied[k]).count());
+			applied.clear();
+			changed = false;
+			nextFrame = shown + framePeriod;
+		}
+
+		// Wait for a key until it's time for the next turn (or frame)
+		Clock::time_point deadline = (changed ? min(nextTick, nextFrame) : nextTick);
+		char key;
+		{
+			PROFILE_SCOPE(PROFILE_INPUT);
+			key = keys.nextKey(tick, deadline);
+		}
+		if (key == 'q')
+			quit = true;
+		else if (key == ' ' || key == '.' || decodeDirection(key) != -1)
+		{
+			pending += key;
+			pressed.push_back(Clock::now());
+		}
+
+		// Play every turn that is due, even if we've fallen behind
+		while (!quit && Clock::now() >= nextTick &&
+			!p->isDead() && m_pit->snakeCount() > 0)
+		{
+			char action = ' ';
+			if (!pending.empty())
+			{
+				action = pending[0];
+				pending.erase(0, 1);
+				applied.push_back(pressed[0]);
+				pressed.erase(pressed.begin());
+			}
+			takeTurn(action);
+			tick++;
+			changed = true;
+			nextTick += tickPeriod;
+		}
+	}
+	if (m_log != nullptr)
+		m_log->finish(*m_pit);
+	m_pit->display("");
+	Clock::time_point shown = Clock::now();
+	for (size_t k = 0; k < applied.size(); k++)
+		latencies.push_back(chrono::duration<double>(shown - applied[k]).count());
+
+	if (!latencies.empty())
+	{
+		sort(latencies.begin(), latencies.end());
+		cout << "Key to frame latency over " << latencies.size() << " keys: median "
+			<< latencies[latencies.size() / 2] * 1000 << " ms, 99th percentile "
+			<< latencies[(latencies.size() * 99) / 100] * 1000 << " ms, maximum "
+			<< latencies.back() * 1000 << " ms" << endl;
+	}
+}
+
+// Play the game with the policy choosing the player's actions and nothing
+// displayed, until it ends, the policy quits, or the player has lasted
+// maxSteps turns.
+GameOutcome Game::simulate(PlayerPolicy& policy, long long maxSteps)
+{
+	ALLOCATION_SCOPE("Game::simulate");
+	GameOutcome outcome = { 0, 0, false, false };
+	Player* p = m_pit->player();
+	if (p == nullptr)
+		return outcome;
+	int nSnakesAtStart = m_pit->snakeCount();
+	while (!p->isDead() && m_pit->snakeCount() > 0 && p->age() < maxSteps)
+	{
+		char action = policy.chooseAction(*m_pit);
+		if (action == 'q')
+			break;
+		takeTurn(action);
+	}
+	if (m_log != nullptr)
+		m_log->finish(*m_pit);
+	outcome.steps = p->age();
+	outcome.snakesKilled = nSnakesAtStart - m_pit->snakeCount();
+	outcome.lost = p->isDead();
+	outcome.won = !p->isDead() && m_pit->snakeCount() == 0;
+	return outcome;
+}
+
+void Game::record(ReplayLog* log)
+{
+	m_log = log;
+	if (m_log != nullptr)
+		m_log->start(*m_pit, m_seed);
+}
+
+void Game::takeTurn(char action)
+{
+	ALLOCATION_SCOPE("Game::takeTurn");
+	m_pit->takeTurn(action);
+	if (m_log != nullptr)
+		m_log->record(*m_pit, action);
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  ReplayLog implementation
+///////////////////////////////////////////////////////////////////////////
+
+// The actions, in the order of their codes in a replay log
+const char ACTION_CODES[] = " udlr";
+
+// A replay file is, all numbers little-endian:
+//   "SNAKEREP", the version (4 bytes), the pit's rows and columns (4 bytes
+//   each), the seed (8), the snapshot interval (4), the number of turns
+//   (8), the number of snapshots (4); the actions, two a byte, the first
+//   in the low half; then the snapshots and the final state, each the
+//   generator state (4 x 8 bytes), the player's row, column and age (4
+//   each), whether it is dead (1), the number of snakes (4), and their
+//   rows then columns (4 each).
+const char REPLAY_MAGIC[] = "SNAKEREP";
+const unsigned int REPLAY_VERSION = 1;
+
+// Append the low nBytes bytes of value to out, least significant first.
+void putBytes(string& out, unsigned long long value, int nBytes)
+{
+	for (int b = 0; b < nBytes; b++)
+		out += static_cast<char>((value >> (8 * b)) & 0xff);
+}
+
+// Read an nBytes-byte number from in at position at, moving at past it.
+// Return false if in ends first.
+bool getBytes(const string& in, size_t& at, int nBytes, unsigned long long& value)
+{
+	if (in.size() - at < static_cast<size_t>(nBytes))
+		return false;
+	value = 0;
+	for (int b = 0; b < nBytes; b++)
+		value |= static_cast<unsigned long long>(static_cast<unsigned char>(in[at + b])) << (8 * b);
+	at += nBytes;
+	return true;
+}
+
+void putState(string& out, const PitState& state)
+{
+	for (int k = 0; k < 4; k++)
+		putBytes(out, state.random[k], 8);
+	putBytes(out, state.playerRow, 4);
+	putBytes(out, state.playerCol, 4);
+	putBytes(out, state.playerAge, 4);
+	putBytes(out, state.playerDead, 1);
+	putBytes(out, state.snakeRows.size(), 4);
+	for (size_t k = 0; k < state.snakeRows.size(); k++)
+		putBytes(out, state.snakeRows[k], 4);
+	for (size_t k = 0; k < state.snakeCols.size(); k++)
+		putBytes(out, state.snakeCols[k], 4);
+}
+
+// Read a state written by putState for a rows x cols pit.  Return false
+// if in ends first or the state is impossible.
+bool getState(const string& in, size_t& at, PitState& state, int rows, int cols)
+{
+	unsigned long long row, col, age, dead, nSnakes;
+	for (int k = 0; k < 4; k++)
+		if (!getBytes(in, at, 8, state.random[k]))
+			return false;
+	if (!getBytes(in, at, 4, row) || !getBytes(in, at, 4, col) ||
+		!getBytes(in, at, 4, age) || !getBytes(in, at, 1, dead) ||
+		!getBytes(in, at, 4, nSnakes))
+		return false;
+	if (row > static_cast<unsigned long long>(rows) ||
+		col > static_cast<unsigned long long>(cols) || (row == 0) != (col == 0) ||
+		(in.size() - at) / 8 < nSnakes)
+		return false;
+	state.playerRow = static_cast<int>(row);
+	state.playerCol = static_cast<int>(col);
+	state.playerAge = static_cast<int>(age);
+	state.playerDead = (dead != 0);
+	state.snakeRows.resize(nSnakes);
+	state.snakeCols.resize(nSnakes);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		vector<int>& positions = (pass == 0 ? state.snakeRows : state.snakeCols);
+		int limit = (pass == 0 ? rows : cols);
+		for (size_t k = 0; k < nSnakes; k++)
+		{
+			unsigned long long position;
+			if (!getBytes(in, at, 4, position) || position < 1 || position > static_cast<unsigned long long>(limit))
+				return false;
+			positions[k] = static_cast<int>(position);
+		}
+	}
+	return true;
+}
+
+ReplayLog::ReplayLog(int snapshotInterval)
+{
+	m_rows = 0;
+	m_cols = 0;
+	m_seed = 0;
+	m_snapshotInterval = (snapshotInterval > 0 ? snapshotInterval : 1);
+	m_turns = 0;
+}
+
+long long ReplayLog::turnCount() const
+{
+	return m_turns;
+}
+
+char ReplayLog::action(long long turn) const
+{
+	return ACTION_CODES[(m_actions[turn / 2] >> (4 * (turn % 2))) & 0xf];
+}
+
+const PitState& ReplayLog::finalState() const
+{
+	return m_final;
+}
+
+// Begin a recording of a game in pit, which was started with seed.
+void ReplayLog::start(const Pit& pit, unsigned long long seed)
+{
+	m_rows = pit.rows();
+	m_cols = pit.cols();
+	m_seed = seed;
+	m_turns = 0;
+	m_actions.clear();
+	m_snapshots.assign(1, PitState());
+	pit.saveState(m_snapshots[0]);
+	m_final = m_snapshots[0];
+}
+
+void ReplayLog::record(const Pit& pit, char action)
+{
+	ALLOCATION_SCOPE("ReplayLog::record");
+	const char* code = strchr(ACTION_CODES, action);
+	int c = (code == nullptr || action == '\0' ? 0 : static_cast<int>(code - ACTION_CODES));
+	if (m_turns % 2 == 0)
+		m_actions.push_back(static_cast<unsigned char>(c));
+	else
+		m_actions.back() |= static_cast<unsigned char>(c << 4);
+	m_turns++;
+	if (m_turns % m_snapshotInterval == 0)
+	{
+		m_snapshots.push_back(PitState());
+		pit.saveState(m_snapshots.back());
+	}
+}
+
+// End the recording, with pit as it was after the last turn.
+void ReplayLog::finish(const Pit& pit)
+{
+	pit.saveState(m_final);
+}
+
+Pit* ReplayLog::replay(long long turn, bool fromStart) const
+{
+	if (turn < 0)
+		turn = 0;
+	if (turn > m_turns)
+		turn = m_turns;
+	long long k = (fromStart ? 0 : turn / m_snapshotInterval);
+	Pit* pit = new Pit(m_rows, m_cols, m_seed);
+	pit->restoreState(m_snapshots[k]);
+	for (long long t = k * m_snapshotInterval; t < turn; t++)
+		pit->takeTurn(action(t));
+	return pit;
+}
+
+bool ReplayLog::save(string path) const
+{
+	ALLOCATION_SCOPE("ReplayLog::save");
+	string out = REPLAY_MAGIC;
+	putBytes(out, REPLAY_VERSION, 4);
+	putBytes(out, m_rows, 4);
+	putBytes(out, m_cols, 4);
+	putBytes(out, m_seed, 8);
+	putBytes(out, m_snapshotInterval, 4);
+	putBytes(out, m_turns, 8);
+	putBytes(out, m_snapshots.size(), 4);
+	out.append(reinterpret_cast<const char*>(m_actions.data()), m_actions.size());
+	for (size_t k = 0; k < m_snapshots.size(); k++)
+		putState(out, m_snapshots[k]);
+	putState(out, m_final);
+
+	ofstream file(path.c_str(), ios::binary);
+	file.write(out.data(), out.size());
+	return file.good();
+}
+
+// Read a log written by save.  Return false, leaving the log unchanged,
+// if the file can't be read or isn't a replay log.
+bool ReplayLog::load(string path)
+{
+	ALLOCATION_SCOPE("ReplayLog::load");
+	ifstream file(path.c_str(), ios::binary);
+	if (!file)
+		return false;
+	string in((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	size_t at = strlen(REPLAY_MAGIC);
+	if (in.compare(0, at, REPLAY_MAGIC) != 0)
+		return false;
+
+	unsigned long long version, rows, cols, seed, interval, turns, nSnapshots;
+	if (!getBytes(in, at, 4, version) || version != REPLAY_VERSION ||
+		!getBytes(in, at, 4, rows) || !getBytes(in, at, 4, cols) ||
+		!getBytes(in, at, 8, seed) || !getBytes(in, at, 4, interval) ||
+		!getBytes(in, at, 8, turns) || !getBytes(in, at, 4, nSnapshots))
+		return false;
+	if (rows == 0 || cols == 0 || rows > 0x7fffffff || cols > 0x7fffffff ||
+		interval == 0 || interval > 0x7fffffff ||
+		nSnapshots != turns / interval + 1 || in.size() - at < (turns + 1) / 2)
+		return false;
+	vector<unsigned char> actions(in.begin() + at, in.begin() + at + (turns + 1) / 2);
+	at += actions.size();
+	for (size_t k = 0; k < actions.size(); k++)
+		if ((actions[k] & 0xf) >= strlen(ACTION_CODES) ||
+			(actions[k] >> 4) >= strlen(ACTION_CODES))
+			return false;
+	vector<PitState> snapshots(nSnapshots);
+	PitState final;
+	for (size_t k = 0; k < nSnapshots; k++)
+		if (!getState(in, at, snapshots[k], static_cast<int>(rows), static_cast<int>(cols)))
+			return false;
+	if (!getState(in, at, final, static_cast<int>(rows), static_cast<int>(cols)))
+		return false;
+
+	m_rows = static_cast<int>(rows);
+	m_cols = static_cast<int>(cols);
+	m_seed = seed;
+	m_snapshotInterval = static_cast<int>(interval);
+	m_turns = static_cast<long long>(turns);
+	m_actions.swap(actions);
+	m_snapshots.swap(snapshots);
+	m_final = final;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Barrier and TiledPit implementations
+///////////////////////////////////////////////////////////////////////////
+
+Barrier::Barrier(int nThreads)
+	: m_nThreads(nThreads), m_nWaiting(0), m_generation(0)
+{
+}
+
+void Barrier::wait()
+{
+	unique_lock<mutex> lock(m_mutex);
+	long long generation = m_generation;
+	m_nWaiting++;
+	if (m_nWaiting == m_nThreads)
+	{
+		m_nWaiting = 0;
+		m_generation++;
+		m_allArrived.notify_all();
+	}
+	else
+		m_allArrived.wait(lock, [&] { return m_generation != generation; });
+}
+
+TiledPit::TiledPit(int nRows, int nCols, int tileRows, int tileCols,
+	unsigned long long seed)
+{
+	if (nRows <= 0 || nCols <= 0 || tileRows <= 0 || tileCols <= 0)
+	{
+		cout << "***** TiledPit created with invalid size " << nRows << " by "
+			<< nCols << " (tiles " << tileRows << " by " << tileCols << ")!" << endl;
+		exit(1);
+	}
+	m_rows = nRows;
+	m_cols = nCols;
+	m_tileRows = tileRows;
+	m_tileCols = tileCols;
+	m_nTileCols = (nCols + tileCols - 1) / tileCols;
+	m_key = mixSeed(seed);
+	m_turn = 0;
+	m_nextId = 0;
+	m_nSnakes = 0;
+	m_playerRow = 0;
+	m_playerCol = 0;
+	m_playerDead = false;
+	m_nWorkers = 1;
+	m_barrier = nullptr;
+	m_turnsStarted = 0;
+	m_nBusy = 0;
+	m_stopping = false;
+
+	for (int top = 1; top <= nRows; top += tileRows)
+		for (int left = 1; left <= nCols; left += tileCols)
+		{
+			PitTile tile;
+			tile.top = top;
+			tile.left = left;
+			tile.nRows = min(tileRows, nRows - top + 1);
+			tile.nCols = min(tileCols, nCols - left + 1);
+			tile.nSnakesAt.assign(static_cast<size_t>(tile.nRows) * tile.nCols, 0);
+			tile.hitPlayer = false;
+			m_tiles.push_back(tile);
+		}
+}
+
+TiledPit::~TiledPit()
+{
+	stopWorkers();
+}
+
+int TiledPit::rows() const
+{
+	return m_rows;
+}
+
+int TiledPit::cols() const
+{
+	return m_cols;
+}
+
+int TiledPit::snakeCount() const
+{
+	return m_nSnakes;
+}
+
+int TiledPit::playerRow() const
+{
+	return m_playerRow;
+}
+
+int TiledPit::playerCol() const
+{
+	return m_playerCol;
+}
+
+bool TiledPit::isPlayerDead() const
+{
+	return m_playerDead;
+}
+
+// The index in m_tiles of the tile containing (r,c)
+int TiledPit::tileOf(int r, int c) const
+{
+	return (r - 1) / m_tileRows * m_nTileCols + (c - 1) / m_tileCols;
+}
+
+// The index in tile's nSnakesAt of (r,c), which is in tile
+int TiledPit::cellOf(const PitTile& tile, int r, int c) const
+{
+	return (r - tile.top) * tile.nCols + (c - tile.left);
+}
+
+int TiledPit::numberOfSnakesAt(int r, int c) const
+{
+	if (r < 1 || r > m_rows || c < 1 || c > m_cols)
+		return 0;
+	const PitTile& tile = m_tiles[tileOf(r, c)];
+	return tile.nSnakesAt[cellOf(tile, r, c)];
+}
+
+unsigned long long TiledPit::checksum() const
+{
+	// Add up a hash of each snake, so the order they're in doesn't matter.
+	unsigned long long sum = 0;
+	for (size_t t = 0; t < m_tiles.size(); t++)
+	{
+		const PitTile& tile = m_tiles[t];
+		for (size_t k = 0; k < tile.ids.size(); k++)
+			sum += mixSeed((static_cast<unsigned long long>(tile.ids[k]) << 40) ^
+				(static_cast<unsigned long long>(tile.rows[k]) << 20) ^ tile.cols[k]);
+	}
+	return sum;
+}
+
+bool TiledPit::addSnake(int r, int c)
+{
+	if (r < 1 || r > m_rows || c < 1 || c > m_cols)
+	{
+		cout << "***** Snake created with invalid coordinates (" << r << ","
+			<< c << ")!" << endl;
+		exit(1);
+	}
+	PitTile& tile = m_tiles[tileOf(r, c)];
+	tile.rows.push_back(r);
+	tile.cols.push_back(c);
+	tile.ids.push_back(m_nextId);
+	tile.nSnakesAt[cellOf(tile, r, c)]++;
+	m_nextId++;
+	m_nSnakes++;
+	return true;
+}
+
+bool TiledPit::addPlayer(int r, int c)
+{
+	if (m_playerRow != 0)
+		return false;
+	if (r < 1 || r > m_rows || c < 1 || c > m_cols)
+	{
+		cout << "**** Player created with invalid coordinates (" << r
+			<< "," << c << ")!" << endl;
+		exit(1);
+	}
+	m_playerRow = r;
+	m_playerCol = c;
+	return true;
+}
+
+bool TiledPit::destroyOneSnake(int r, int c)
+{
+	if (numberOfSnakesAt(r, c) == 0)
+		return false;
+
+	// Destroy the lowest numbered snake there, so the choice doesn't depend
+	// on the order of the tile's arrays.
+	PitTile& tile = m_tiles[tileOf(r, c)];
+	int victim = -1;
+	for (size_t k = 0; k < tile.ids.size(); k++)
+		if (tile.rows[k] == r && tile.cols[k] == c &&
+			(victim == -1 || tile.ids[k] < tile.ids[victim]))
+			victim = static_cast<int>(k);
+	tile.nSnakesAt[cellOf(tile, r, c)]--;
+	tile.rows[victim] = tile.rows.back();
+	tile.cols[victim] = tile.cols.back();
+	tile.ids[victim] = tile.ids.back();
+	tile.rows.pop_back();
+	tile.cols.pop_back();
+	tile.ids.pop_back();
+	m_nSnakes--;
+	return true;
+}
+
+void TiledPit::movePlayer(int dir)
+{
+	int rowDelta;
+	int colDelta;
+	if (m_playerRow == 0 || !directionToDeltas(dir, rowDelta, colDelta))
+		return;
+	int r1 = m_playerRow + rowDelta;
+	int c1 = m_playerCol + colDelta;
+	if (r1 < 1 || r1 > m_rows || c1 < 1 || c1 > m_cols)  // against wall
+		return;
+	if (numberOfSnakesAt(r1, c1) == 0)
+	{
+		m_playerRow = r1;
+		m_playerCol = c1;
+		return;
+	}
+
+	// Adjacent snake in direction of movement, so jump
+	int r2 = r1 + rowDelta;
+	int c2 = c1 + colDelta;
+	if (r2 < 1 || r2 > m_rows || c2 < 1 || c2 > m_cols)
+		return;
+	destroyOneSnake(r1, c1);
+	m_playerRow = r2;
+	m_playerCol = c2;
+	if (numberOfSnakesAt(r2, c2) > 0)  // landed on a snake!
+		m_playerDead = true;
+}
+
+// Move the snakes of a tile, setting aside those that leave it.
+void TiledPit::moveTileSnakes(PitTile& tile)
+{
+	tile.outRows.clear();
+	tile.outCols.clear();
+	tile.outIds.clear();
+	tile.hitPlayer = false;
+	int bottom = tile.top + tile.nRows - 1;
+	int right = tile.left + tile.nCols - 1;
+	size_t k = 0;
+	while (k < tile.ids.size())
+	{
+		// A hash of the snake's number and the turn gives the snake's next
+		// 32 directions.
+		unsigned long long bits = mixSeed(m_key ^
+			(static_cast<unsigned long long>(tile.ids[k]) << 32) ^ (m_turn / 32));
+		int dir = static_cast<int>(bits >> (2 * (m_turn % 32))) & 3;
+		int r = tile.rows[k];
+		int c = tile.cols[k];
+		switch (dir)
+		{
+		case UP:     if (r > 1)      r--; break;
+		case DOWN:   if (r < m_rows) r++; break;
+		case LEFT:   if (c > 1)      c--; break;
+		case RIGHT:  if (c < m_cols) c++; break;
+		}
+		if (r == m_playerRow && c == m_playerCol)
+			tile.hitPlayer = true;
+		if (r == tile.rows[k] && c == tile.cols[k])
+		{
+			k++;
+			continue;
+		}
+		tile.nSnakesAt[cellOf(tile, tile.rows[k], tile.cols[k])]--;
+		if (r >= tile.top && r <= bottom && c >= tile.left && c <= right)
+		{
+			tile.rows[k] = r;
+			tile.cols[k] = c;
+			tile.nSnakesAt[cellOf(tile, r, c)]++;
+			k++;
+		}
+		else
+		{
+			// Hand it on, replacing it with the last snake, which is then
+			// moved in its turn.
+			tile.outRows.push_back(r);
+			tile.outCols.push_back(c);
+			tile.outIds.push_back(tile.ids[k]);
+			tile.rows[k] = tile.rows.back();
+			tile.cols[k] = tile.cols.back();
+			tile.ids[k] = tile.ids.back();
+			tile.rows.pop_back();
+			tile.cols.pop_back();
+			tile.ids.pop_back();
+		}
+	}
+}
+
+// Take into tile t the snakes that moved into it from its neighbors.
+void TiledPit::takeMigrants(int t)
+{
+	PitTile& tile = m_tiles[t];
+	int nTileRows = (m_rows + m_tileRows - 1) / m_tileRows;
+	int tileRow = t / m_nTileCols;
+	int tileCol = t % m_nTileCols;
+	const int NEIGHBOR_ROWS[4] = { -1, 0, 0, 1 };
+	const int NEIGHBOR_COLS[4] = { 0, -1, 1, 0 };
+	for (int n = 0; n < 4; n++)
+	{
+		int fromRow = tileRow + NEIGHBOR_ROWS[n];
+		int fromCol = tileCol + NEIGHBOR_COLS[n];
+		if (fromRow < 0 || fromRow >= nTileRows || fromCol < 0 || fromCol >= m_nTileCols)
+			continue;
+		const PitTile& from = m_tiles[fromRow * m_nTileCols + fromCol];
+		for (size_t k = 0; k < from.outIds.size(); k++)
+		{
+			int r = from.outRows[k];
+			int c = from.outCols[k];
+			if (r < tile.top || r >= tile.top + tile.nRows ||
+				c < tile.left || c >= tile.left + tile.nCols)
+				continue;
+			tile.rows.push_back(r);
+			tile.cols.push_back(c);
+			tile.ids.push_back(from.outIds[k]);
+			tile.nSnakesAt[cellOf(tile, r, c)]++;
+		}
+	}
+}
+
+// Move every snake, on nThreads threads.  Return true if the player is
+// still alive.
+bool TiledPit::moveSnakes(int nThreads)
+{
+	ALLOCATION_SCOPE("TiledPit::moveSnakes");
+	int nTiles = static_cast<int>(m_tiles.size());
+	if (nThreads > nTiles)
+		nThreads = nTiles;
+	if (nThreads < 1)
+		nThreads = 1;
+	if (nThreads != m_nWorkers)
+		startWorkers(nThreads);
+
+	// Wake the workers for this turn, do worker 0's share, and wait for
+	// the rest.
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_nBusy = m_nWorkers - 1;
+		m_turnsStarted++;
+	}
+	m_turnStarted.notify_all();
+	moveOwnedSnakes(0);
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_turnFinished.wait(lock, [&] { return m_nBusy == 0; });
+	}
+
+	for (int t = 0; t < nTiles; t++)
+		if (m_tiles[t].hitPlayer)
+			m_playerDead = true;
+	m_turn++;
+
+	// return true if the player is still alive, false otherwise
+	return !m_playerDead;
+}
+
+// Move the snakes of worker w's tiles, wait for every worker to finish
+// that, then take in the snakes that moved into those tiles.
+void TiledPit::moveOwnedSnakes(int w)
+{
+	int nTiles = static_cast<int>(m_tiles.size());
+	for (int t = w; t < nTiles; t += m_nWorkers)
+		moveTileSnakes(m_tiles[t]);
+	if (m_barrier != nullptr)
+		m_barrier->wait();
+	for (int t = w; t < nTiles; t += m_nWorkers)
+		takeMigrants(t);
+}
+
+void TiledPit::startWorkers(int nThreads)
+{
+	stopWorkers();
+	m_nWorkers = nThreads;
+	m_stopping = false;
+	if (nThreads > 1)
+		m_barrier = new Barrier(nThreads);
+	long long turnsStarted = m_turnsStarted;
+	for (int w = 1; w < nThreads; w++)
+		m_workers.push_back(thread([this, w, turnsStarted] {
+			workerLoop(w, turnsStarted);
+		}));
+}
+
+void TiledPit::stopWorkers()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_turnStarted.notify_all();
+	for (size_t w = 0; w < m_workers.size(); w++)
+		m_workers[w].join();
+	m_workers.clear();
+	delete m_barrier;
+	m_barrier = nullptr;
+	m_nWorkers = 1;
+}
+
+void TiledPit::workerLoop(int w, long long turnsSeen)
+{
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_turnStarted.wait(lock, [&] {
+				return m_stopping || m_turnsStarted != turnsSeen;
+			});
+			if (m_stopping)
+				return;
+			turnsSeen = m_turnsStarted;
+		}
+		moveOwnedSnakes(w);
+		lock_guard<mutex> lock(m_mutex);
+		if (--m_nBusy == 0)
+			m_turnFinished.notify_one();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  LodPit implementation
+///////////////////////////////////////////////////////////////////////////
+
+LodPit::LodPit(int nRows, int nCols, int blockSize, int radius, unsigned long long seed)
+	: m_random(seed)
+{
+	if (nRows <= 0 || nCols <= 0 || blockSize <= 0 || radius < 0)
+	{
+		cout << "***** LodPit created with invalid size " << nRows << " by "
+			<< nCols << " (blocks " << blockSize << ", radius " << radius << ")!" << endl;
+		exit(1);
+	}
+	m_rows = nRows;
+	m_cols = nCols;
+	m_blockSize = blockSize;
+	m_nBlockRows = (nRows + blockSize - 1) / blockSize;
+	m_nBlockCols = (nCols + blockSize - 1) / blockSize;
+	m_radius = (radius + blockSize - 1) / blockSize;
+	m_playerRow = 0;
+	m_playerCol = 0;
+	m_playerDead = false;
+	m_nSnakesAt.assign(static_cast<size_t>(nRows) * nCols, 0);
+
+	// Until there is a player, every block is exact.
+	int nBlocks = m_nBlockRows * m_nBlockCols;
+	m_isExact.assign(nBlocks, 1);
+	for (int b = 0; b < nBlocks; b++)
+		m_exactBlocks.push_back(b);
+	m_density.assign(nBlocks, 0);
+	m_nextDensity.assign(nBlocks, 0);
+}
+
+int LodPit::rows() const
+{
+	return m_rows;
+}
+
+int LodPit::cols() const
+{
+	return m_cols;
+}
+
+double LodPit::snakeCount() const
+{
+	double count = exactSnakeCount();
+	for (size_t b = 0; b < m_density.size(); b++)
+		count += m_density[b];
+	return count;
+}
+
+int LodPit::exactSnakeCount() const
+{
+	return static_cast<int>(m_snakeRows.size());
+}
+
+int LodPit::playerRow() const
+{
+	return m_playerRow;
+}
+
+int LodPit::playerCol() const
+{
+	return m_playerCol;
+}
+
+bool LodPit::isPlayerDead() const
+{
+	return m_playerDead;
+}
+
+int LodPit::blockOf(int r, int c) const
+{
+	return (r - 1) / m_blockSize * m_nBlockCols + (c - 1) / m_blockSize;
+}
+
+int LodPit::cell(int r, int c) const
+{
+	return (r - 1) * m_cols + (c - 1);
+}
+
+int LodPit::numberOfSnakesAt(int r, int c) const
+{
+	if (r < 1 || r > m_rows || c < 1 || c > m_cols)
+		return 0;
+	return m_nSnakesAt[cell(r, c)];
+}
+
+bool LodPit::addSnake(int r, int c)
+{
+	if (r < 1 || r > m_rows || c < 1 || c > m_cols)
+	{
+		cout << "***** Snake created with invalid coordinates (" << r << ","
+			<< c << ")!" << endl;
+		exit(1);
+	}
+	int b = blockOf(r, c);
+	if (m_isExact[b])
+		addExactSnake(r, c);
+	else
+		m_density[b] += 1;
+	return true;
+}
+
+bool LodPit::addPlayer(int r, int c)
+{
+	if (m_playerRow != 0)
+		return false;
+	if (r < 1 || r > m_rows || c < 1 || c > m_cols)
+	{
+		cout << "**** Player created with invalid coordinates (" << r
+			<< "," << c << ")!" << endl;
+		exit(1);
+	}
+	m_playerRow = r;
+	m_playerCol = c;
+	updateZone();
+	return true;
+}
+
+void LodPit::addExactSnake(int r, int c)
+{
+	m_snakeRows.push_back(r);
+	m_snakeCols.push_back(c);
+	m_nSnakesAt[cell(r, c)]++;
+}
+
+// Remove exact snake k, moving the last into its place.
+void LodPit::removeExactSnake(int k)
+{
+	m_nSnakesAt[cell(m_snakeRows[k], m_snakeCols[k])]--;
+	m_snakeRows[k] = m_snakeRows.back();
+	m_snakeCols[k] = m_snakeCols.back();
+	m_snakeRows.pop_back();
+	m_snakeCols.pop_back();
+}
+
+void LodPit::destroyOneSnake(int r, int c)
+{
+	for (int k = 0; k < exactSnakeCount(); k++)
+		if (m_snakeRows[k] == r && m_snakeCols[k] == c)
+		{
+			removeExactSnake(k);
+			return;
+		}
+}
+
+// Give exact block b an expected number of snakes (rounded up or down at
+// random, so that on average it's exact).  They go anywhere in the block,
+// or, if they are coming in from a neighboring block (fromDir, the
+// direction that block is in, not -1), anywhere along that edge.
+void LodPit::materialize(int b, double expected, int fromDir)
+{
+	int n = static_cast<int>(expected);
+	if (m_random.next() < (expected - n) * 18446744073709551616.0)
+		n++;
+	int top = b / m_nBlockCols * m_blockSize + 1;
+	int left = b % m_nBlockCols * m_blockSize + 1;
+	int height = min(m_blockSize, m_rows - top + 1);
+	int width = min(m_blockSize, m_cols - left + 1);
+	for (int k = 0; k < n; k++)
+	{
+		int r = top + m_random.below(height);
+		int c = left + m_random.below(width);
+		switch (fromDir)
+		{
+		case UP:     r = top;              break;
+		case DOWN:   r = top + height - 1; break;
+		case LEFT:   c = left;             break;
+		case RIGHT:  c = left + width - 1; break;
+		}
+		addExactSnake(r, c);
+	}
+}
+
+// Make the blocks near the player exact and the ones far from it not
+void LodPit::updateZone()
+{
+	int playerBlockRow = (m_playerRow - 1) / m_blockSize;
+	int playerBlockCol = (m_playerCol - 1) / m_blockSize;
+
+	// A block is made exact within m_radius blocks of the player's, and
+	// stays exact until it's more than a block further away, so that
+	// moving to and fro across a block edge doesn't make and unmake them.
+	vector<int> stillExact;
+	for (size_t k = 0; k < m_exactBlocks.size(); k++)
+	{
+		int b = m_exactBlocks[k];
+		int distance = max(abs(b / m_nBlockCols - playerBlockRow),
+			abs(b % m_nBlockCols - playerBlockCol));
+		if (distance <= m_radius + 1)
+			stillExact.push_back(b);
+		else
+			m_isExact[b] = 0;
+	}
+	if (stillExact.size() != m_exactBlocks.size())
+	{
+		m_exactBlocks.swap(stillExact);
+		for (int k = 0; k < exactSnakeCount(); )
+		{
+			int b = blockOf(m_snakeRows[k], m_snakeCols[k]);
+			if (m_isExact[b])
+				k++;
+			else
+			{
+				m_density[b] += 1;
+				removeExactSnake(k);
+			}
+		}
+	}
+
+	for (int br = max(playerBlockRow - m_radius, 0);
+		br <= min(playerBlockRow + m_radius, m_nBlockRows - 1); br++)
+		for (int bc = max(playerBlockCol - m_radius, 0);
+			bc <= min(playerBlockCol + m_radius, m_nBlockCols - 1); bc++)
+		{
+			int b = br * m_nBlockCols + bc;
+			if (m_isExact[b])
+				continue;
+			m_isExact[b] = 1;
+			m_exactBlocks.push_back(b);
+			materialize(b, m_density[b], -1);
+			m_density[b] = 0;
+		}
+}
+
+// Move the exact snakes as Pit::moveSnakes does.  A snake walking out of
+// the exact blocks joins the density of the block it walks into.
+void LodPit::moveExactSnakes()
+{
+	unsigned long long bits = 0;
+	int n = exactSnakeCount();
+	for (int k = 0, drawn = 0; k < n; drawn++)
+	{
+		if (drawn % 32 == 0)
+			bits = m_random.next();
+		int r = m_snakeRows[k];
+		int c = m_snakeCols[k];
+		switch ((bits >> (2 * (drawn % 32))) & 3)
+		{
+		case UP:     if (r > 1)      r--; break;
+		case DOWN:   if (r < m_rows) r++; break;
+		case LEFT:   if (c > 1)      c--; break;
+		case RIGHT:  if (c < m_cols) c++; break;
+		}
+		int b = blockOf(r, c);
+		if (!m_isExact[b])
+		{
+			m_density[b] += 1;
+			removeExactSnake(k);  // the last snake moves into place k...
+			n--;                  // ...and hasn't moved yet
+			continue;
+		}
+		m_nSnakesAt[cell(m_snakeRows[k], m_snakeCols[k])]--;
+		m_nSnakesAt[cell(r, c)]++;
+		m_snakeRows[k] = r;
+		m_snakeCols[k] = c;
+		if (r == m_playerRow && c == m_playerCol)
+			m_playerDead = true;
+		k++;
+	}
+}
+
+// Spread the density of the blocks that aren't exact one turn's worth.
+// Snakes spread evenly over a block h rows high cross its top edge at a
+// rate of 1/(4h) a turn (1/h of them are on the top row, and a quarter of
+// those go up), and so on for the other edges.
+void LodPit::diffuse()
+{
+	const int DIR_ROWS[4] = { -1, 1, 0, 0 };  // indexed by UP, DOWN, ...
+	const int DIR_COLS[4] = { 0, 0, -1, 1 };
+	const int OPPOSITE[4] = { DOWN, UP, RIGHT, LEFT };
+	m_nextDensity = m_density;
+	for (int br = 0; br < m_nBlockRows; br++)
+		for (int bc = 0; bc < m_nBlockCols; bc++)
+		{
+			int b = br * m_nBlockCols + bc;
+			double d = m_density[b];
+			if (m_isExact[b] || d == 0)
+				continue;
+			int height = min(m_blockSize, m_rows - br * m_blockSize);
+			int width = min(m_blockSize, m_cols - bc * m_blockSize);
+			for (int dir = 0; dir < 4; dir++)
+			{
+				int nbr = br + DIR_ROWS[dir];
+				int nbc = bc + DIR_COLS[dir];
+				if (nbr < 0 || nbr >= m_nBlockRows || nbc < 0 || nbc >= m_nBlockCols)
+					continue;  // the pit wall
+				double flow = d / (4.0 * (DIR_ROWS[dir] != 0 ? height : width));
+				int neighbor = nbr * m_nBlockCols + nbc;
+				m_nextDensity[b] -= flow;
+				if (m_isExact[neighbor])
+					materialize(neighbor, flow, OPPOSITE[dir]);
+				else
+					m_nextDensity[neighbor] += flow;
+			}
+		}
+	m_density.swap(m_nextDensity);
+}
+
+bool LodPit::takeTurn(char action)
+{
+	ALLOCATION_SCOPE("LodPit::takeTurn");
+	// Move the player as Player::move does
+	int rowDelta;
+	int colDelta;
+	if (directionToDeltas(decodeDirection(action), rowDelta, colDelta))
+	{
+		int r1 = m_playerRow + rowDelta;
+		int c1 = m_playerCol + colDelta;
+		int r2 = r1 + rowDelta;
+		int c2 = c1 + colDelta;
+		bool againstWall = (r1 < 1 || r1 > m_rows || c1 < 1 || c1 > m_cols);
+		if (!againstWall && numberOfSnakesAt(r1, c1) == 0)
+		{
+			m_playerRow = r1;
+			m_playerCol = c1;
+		}
+		else if (!againstWall && r2 >= 1 && r2 <= m_rows && c2 >= 1 && c2 <= m_cols)
+		{
+			destroyOneSnake(r1, c1);
+			m_playerRow = r2;
+			m_playerCol = c2;
+			if (numberOfSnakesAt(r2, c2) > 0)  // landed on a snake!
+				m_playerDead = true;
+		}
+	}
+	updateZone();
+	moveExactSnakes();
+	diffuse();
+
+	// return true if the player is still alive, false otherwise
+	return !m_playerDead;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  KeySource implementations
+///////////////////////////////////////////////////////////////////////////
+
+TerminalKeys::TerminalKeys()
+{
+#ifndef _MSC_VER
+	// Turn off line editing and echo, if stdin is a terminal
+	m_rawMode = (tcgetattr(STDIN_FILENO, &m_savedMode) == 0);
+	if (m_rawMode)
+	{
+		termios raw = m_savedMode;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 1;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+	}
+#endif
+}
+
+TerminalKeys::~TerminalKeys()
+{
+#ifndef _MSC_VER
+	if (m_rawMode)
+		tcsetattr(STDIN_FILENO, TCSANOW, &m_savedMode);
+#endif
+}
+
+char TerminalKeys::nextKey(long long, chrono::steady_clock::time_point deadline)
+{
+	for (;;)
+	{
+		chrono::steady_clock::duration left = deadline - chrono::steady_clock::now();
+		long long ms = chrono::duration_cast<chrono::milliseconds>(left).count();
+#ifdef _MSC_VER
+		if (_kbhit())
+			return static_cast<char>(_getch());
+		if (ms <= 0)
+			return '\0';
+		this_thread::sleep_for(chrono::milliseconds(1));
+#else
+		if (left.count() < 0)
+			ms = 0;
+		else if (ms == 0)
+			ms = 1;  // poll can't wait less than a millisecond
+		pollfd input = { STDIN_FILENO, POLLIN, 0 };
+		int ready = poll(&input, 1, static_cast<int>(ms));
+		if (ready > 0)
+		{
+			char key;
+			if (read(STDIN_FILENO, &key, 1) == 1)
+				return key;
+			// End of input:  no more keys will come
+			this_thread::sleep_until(deadline);
+			return '\0';
+		}
+		if (ready == 0 || chrono::steady_clock::now() >= deadline)
+			return '\0';
+#endif
+	}
+}
+
+bool ScriptedKeys::load(string path)
+{
+	ifstream file(path.c_str());
+	if (!file)
+		return false;
+	m_ticks.clear();
+	m_keys.clear();
+	m_next = 0;
+	string line;
+	while (getline(file, line))
+	{
+		size_t space = line.find(' ');
+		if (line.empty() || line[0] == '#')
+			continue;
+		if (space == string::npos || space + 1 >= line.size())
+			return false;
+		m_ticks.push_back(atoll(line.c_str()));
+		m_keys += line[space + 1];
+	}
+	return true;
+}
+
+char ScriptedKeys::nextKey(long long tick, chrono::steady_clock::time_point deadline)
+{
+	if (m_next < m_keys.size() && m_ticks[m_next] <= tick)
+	{
+		m_next++;
+		return m_keys[m_next - 1];
+	}
+	this_thread::sleep_until(deadline);
+	return '\0';
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  PlayerPolicy implementations
+///////////////////////////////////////////////////////////////////////////
+
+RandomPolicy::RandomPolicy(unsigned long long seed)
+	: m_random(seed)
+{
+}
+
+char RandomPolicy::chooseAction(const Pit&)
+{
+	const char ACTIONS[] = "udlr ";
+	return ACTIONS[m_random.below(5)];
+}
+
+char GreedyEscapePolicy::chooseAction(const Pit& pit)
+{
+	ALLOCATION_SCOPE("GreedyEscapePolicy::chooseAction");
+	const Player* p = pit.player();
+	const char ACTIONS[] = " udlr";
+	char best = ' ';
+	int bestThreat = 0;
+	bool bestKills = false;
+	for (int a = 0; ACTIONS[a] != '\0'; a++)
+	{
+		// Work out where the action would leave the player, as Player::move
+		// would.
+		int r = p->row();
+		int c = p->col();
+		bool kills = false;
+		int rowDelta;
+		int colDelta;
+		if (directionToDeltas(decodeDirection(ACTIONS[a]), rowDelta, colDelta))
+		{
+			int r1 = r + rowDelta;
+			int c1 = c + colDelta;
+			if (r1 < 1 || r1 > pit.rows() || c1 < 1 || c1 > pit.cols())
+				continue;  // against the wall, the same as standing
+			if (pit.numberOfSnakesAt(r1, c1) == 0)
+			{
+				r = r1;
+				c = c1;
+			}
+			else
+			{
+				int r2 = r1 + rowDelta;
+				int c2 = c1 + colDelta;
+				if (r2 < 1 || r2 > pit.rows() || c2 < 1 || c2 > pit.cols())
+					continue;  // can't jump, so the same as standing
+				if (pit.numberOfSnakesAt(r2, c2) > 0)
+					continue;  // would land on a snake
+				r = r2;
+				c = c2;
+				kills = true;
+			}
+		}
+
+		// Snakes next to the new position could move onto it.  (A snake
+		// jumped over is gone, but it's no longer next to the player.)
+		int threat = pit.numberOfSnakesAt(r - 1, c) + pit.numberOfSnakesAt(r + 1, c) +
+			pit.numberOfSnakesAt(r, c - 1) + pit.numberOfSnakesAt(r, c + 1);
+		if (a == 0 || threat < bestThreat || (threat == bestThreat && kills && !bestKills))
+		{
+			best = ACTIONS[a];
+			bestThreat = threat;
+			bestKills = kills;
+		}
+	}
+	return best;
+}
+
+ScriptedPolicy::ScriptedPolicy(string actions)
+	: m_actions(actions), m_next(0)
+{
+}
+
+char ScriptedPolicy::chooseAction(const Pit&)
+{
+	if (m_next == m_actions.size())
+		return ' ';
+	char action = m_actions[m_next];
+	m_next++;
+	return action == '.' ? ' ' : action;
+}
+
+RolloutPolicy::RolloutPolicy(unsigned long long seed, int nRollouts, int depth)
+	: m_random(seed)
+{
+	m_nRollouts = max(nRollouts, 5);
+	m_depth = max(depth, 1);
+	m_nodes = 0;
+	m_decisions = 0;
+	m_seconds = 0;
+	m_longestDecision = 0;
+}
+
+char RolloutPolicy::chooseAction(const Pit& pit)
+{
+	ALLOCATION_SCOPE("RolloutPolicy::chooseAction");
+	CompactGameState now;
+	if (!now.fromPit(pit))
+		return m_fallback.chooseAction(pit);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	const char ACTIONS[] = " udlr";
+	const int N_ACTIONS = 5;
+	double scores[N_ACTIONS] = { 0 };
+	long long nodes = 0;
+	for (int r = 0; r < m_nRollouts / N_ACTIONS; r++)
+	{
+		// Every action is tried against the same snake and player moves,
+		// so the differences between their scores come from the action.
+		// (The game's own generator state is replaced:  the snakes'
+		// moves are what the bot can't know.)
+		RandomGenerator snakes(m_random.next());
+		RandomGenerator players(m_random.next());
+		for (int a = 0; a < N_ACTIONS; a++)
+		{
+			CompactGameState rollout = now;
+			rollout.random = snakes;
+			RandomGenerator player = players;
+			int nSnakesAtStart = rollout.nSnakes;
+			rollout.takeTurn(ACTIONS[a]);
+			int turns = 1;
+			while (turns < m_depth && !rollout.isOver())
+			{
+				rollout.takeTurn(ACTIONS[player.below(N_ACTIONS)]);
+				turns++;
+			}
+			nodes += turns;
+			int survived = (rollout.playerDead ? turns - 1 : m_depth);
+			scores[a] += survived + 2 * (nSnakesAtStart - rollout.nSnakes);
+		}
+	}
+
+	int best = 0;
+	for (int a = 1; a < N_ACTIONS; a++)
+		if (scores[a] > scores[best])
+			best = a;
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	m_nodes += nodes;
+	m_decisions++;
+	m_seconds += seconds;
+	m_longestDecision = max(m_longestDecision, seconds);
+	return ACTIONS[best];
+}
+
+long long RolloutPolicy::nodes() const
+{
+	return m_nodes;
+}
+
+long long RolloutPolicy::decisions() const
+{
+	return m_decisions;
+}
+
+double RolloutPolicy::seconds() const
+{
+	return m_seconds;
+}
+
+double RolloutPolicy::longestDecision() const
+{
+	return m_longestDecision;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Auxiliary function implementation
+///////////////////////////////////////////////////////////////////////////
+
+int decodeDirection(char dir)
+{
+	switch (dir)
+	{
+	case 'u':  return UP;
+	case 'd':  return DOWN;
+	case 'l':  return LEFT;
+	case 'r':  return RIGHT;
 	}
 	return -1;  // bad argument passed in!
 }
@@ -534,22 +3124,1053 @@ bool directionToDeltas(int dir, int& rowDelta, int& colDelta)
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////
+//  Snake step kernels
+///////////////////////////////////////////////////////////////////////////
+
+// Move snakes first through last-1, whose positions are (rows[k],cols[k]),
+// in an nRows by nCols pit:  snake k tries to go in direction
+// (directionBits[k/32] >> 2*(k%32)) & 3, staying put if that's into a wall.
+// Set moves[k] to the direction it went, or NOT_MOVED.  Return true if any
+// of the snakes ends up at (playerRow,playerCol).
+bool stepSnakesScalar(int* rows, int* cols, const unsigned long long* directionBits,
+	int* moves, int first, int last, int nRows, int nCols, int playerRow, int playerCol)
+{
+	bool hit = false;
+	for (int k = first; k < last; k++)
+	{
+		int dir = static_cast<int>(directionBits[k / 32] >> (2 * (k % 32))) & 3;
+		int& row = rows[k];
+		int& col = cols[k];
+		moves[k] = dir;
+		switch (dir)
+		{
+		case UP:     if (row > 1)     row--; else moves[k] = NOT_MOVED; break;
+		case DOWN:   if (row < nRows) row++; else moves[k] = NOT_MOVED; break;
+		case LEFT:   if (col > 1)     col--; else moves[k] = NOT_MOVED; break;
+		case RIGHT:  if (col < nCols) col++; else moves[k] = NOT_MOVED; break;
+		}
+		if (row == playerRow && col == playerCol)
+			hit = true;
+	}
+	return hit;
+}
+
+// stepSnakesScalar for snakes 0 through n-1, a vector of snakes at a time:
+// 16 with AVX-512, 8 with AVX2, or 4 with SSE2 (always there on x86-64).  Each lane works out the same thing as the
+// scalar loop without branching:  a snake moves up if its direction is UP
+// and it isn't in row 1, and so on, and comparisons give -1 for true, so
+// adding "moves up" and subtracting "moves down" updates its row.
+bool stepSnakes(int* rows, int* cols, const unsigned long long* directionBits,
+	int* moves, int n, int nRows, int nCols, int playerRow, int playerCol)
+{
+	int k = 0;
+	bool hit = false;
+#if defined(__AVX512F__)
+	// 16 snakes at a time; their directions are 32 bits of a word.
+	const __m512i shifts = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14,
+		16, 18, 20, 22, 24, 26, 28, 30);
+	const __m512i one = _mm512_set1_epi32(1);
+	const __m512i three = _mm512_set1_epi32(3);
+	const __m512i lastRow = _mm512_set1_epi32(nRows);
+	const __m512i lastCol = _mm512_set1_epi32(nCols);
+	const __m512i notMoved = _mm512_set1_epi32(NOT_MOVED);
+	const __m512i playerRows = _mm512_set1_epi32(playerRow);
+	const __m512i playerCols = _mm512_set1_epi32(playerCol);
+	__mmask16 hits = 0;
+	for (; k + 16 <= n; k += 16)
+	{
+		int bits = static_cast<int>(directionBits[k / 32] >> (2 * (k % 32)));
+		__m512i dir = _mm512_and_si512(
+			_mm512_maskz_srlv_epi32(0xFFFF, _mm512_set1_epi32(bits), shifts), three);
+		__m512i row = _mm512_loadu_si512(rows + k);
+		__m512i col = _mm512_loadu_si512(cols + k);
+		__mmask16 up = _mm512_cmpeq_epi32_mask(dir, _mm512_set1_epi32(UP)) &
+			_mm512_cmpneq_epi32_mask(row, one);
+		__mmask16 down = _mm512_cmpeq_epi32_mask(dir, _mm512_set1_epi32(DOWN)) &
+			_mm512_cmpneq_epi32_mask(row, lastRow);
+		__mmask16 left = _mm512_cmpeq_epi32_mask(dir, _mm512_set1_epi32(LEFT)) &
+			_mm512_cmpneq_epi32_mask(col, one);
+		__mmask16 right = _mm512_cmpeq_epi32_mask(dir, _mm512_set1_epi32(RIGHT)) &
+			_mm512_cmpneq_epi32_mask(col, lastCol);
+		row = _mm512_mask_add_epi32(_mm512_mask_sub_epi32(row, up, row, one), down, row, one);
+		col = _mm512_mask_add_epi32(_mm512_mask_sub_epi32(col, left, col, one), right, col, one);
+		_mm512_storeu_si512(rows + k, row);
+		_mm512_storeu_si512(cols + k, col);
+		_mm512_storeu_si512(moves + k,
+			_mm512_mask_blend_epi32(up | down | left | right, notMoved, dir));
+		hits |= _mm512_cmpeq_epi32_mask(row, playerRows) &
+			_mm512_cmpeq_epi32_mask(col, playerCols);
+	}
+	hit = (hits != 0);
+#elif defined(__AVX2__)
+	// 8 snakes at a time; their directions are 16 bits of a word.
+	const __m256i shifts = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i three = _mm256_set1_epi32(3);
+	const __m256i lastRow = _mm256_set1_epi32(nRows);
+	const __m256i lastCol = _mm256_set1_epi32(nCols);
+	const __m256i notMoved = _mm256_set1_epi32(NOT_MOVED);
+	const __m256i playerRows = _mm256_set1_epi32(playerRow);
+	const __m256i playerCols = _mm256_set1_epi32(playerCol);
+	__m256i hits = _mm256_setzero_si256();
+	for (; k + 8 <= n; k += 8)
+	{
+		int bits = static_cast<int>(directionBits[k / 32] >> (2 * (k % 32)));
+		__m256i dir = _mm256_and_si256(
+			_mm256_srlv_epi32(_mm256_set1_epi32(bits), shifts), three);
+		__m256i row = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + k));
+		__m256i col = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cols + k));
+		__m256i up = _mm256_andnot_si256(_mm256_cmpeq_epi32(row, one),
+			_mm256_cmpeq_epi32(dir, _mm256_set1_epi32(UP)));
+		__m256i down = _mm256_andnot_si256(_mm256_cmpeq_epi32(row, lastRow),
+			_mm256_cmpeq_epi32(dir, _mm256_set1_epi32(DOWN)));
+		__m256i left = _mm256_andnot_si256(_mm256_cmpeq_epi32(col, one),
+			_mm256_cmpeq_epi32(dir, _mm256_set1_epi32(LEFT)));
+		__m256i right = _mm256_andnot_si256(_mm256_cmpeq_epi32(col, lastCol),
+			_mm256_cmpeq_epi32(dir, _mm256_set1_epi32(RIGHT)));
+		row = _mm256_sub_epi32(_mm256_add_epi32(row, up), down);
+		col = _mm256_sub_epi32(_mm256_add_epi32(col, left), right);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rows + k), row);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(cols + k), col);
+		__m256i moved = _mm256_or_si256(_mm256_or_si256(up, down),
+			_mm256_or_si256(left, right));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(moves + k),
+			_mm256_blendv_epi8(notMoved, dir, moved));
+		hits = _mm256_or_si256(hits, _mm256_and_si256(
+			_mm256_cmpeq_epi32(row, playerRows), _mm256_cmpeq_epi32(col, playerCols)));
+	}
+	hit = !_mm256_testz_si256(hits, hits);
+#elif defined(__SSE2__) || defined(_M_X64)
+	// 4 snakes at a time; their directions are 8 bits of a word.  SSE2 has
+	// no per-lane shift or blend, so the directions are split up with
+	// scalar shifts and the moves merged with and/or.
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i lastRow = _mm_set1_epi32(nRows);
+	const __m128i lastCol = _mm_set1_epi32(nCols);
+	const __m128i notMoved = _mm_set1_epi32(NOT_MOVED);
+	const __m128i playerRows = _mm_set1_epi32(playerRow);
+	const __m128i playerCols = _mm_set1_epi32(playerCol);
+	__m128i hits = _mm_setzero_si128();
+	for (; k + 4 <= n; k += 4)
+	{
+		int bits = static_cast<int>(directionBits[k / 32] >> (2 * (k % 32)));
+		__m128i dir = _mm_setr_epi32(bits & 3, (bits >> 2) & 3, (bits >> 4) & 3,
+			(bits >> 6) & 3);
+		__m128i row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + k));
+		__m128i col = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cols + k));
+		__m128i up = _mm_andnot_si128(_mm_cmpeq_epi32(row, one),
+			_mm_cmpeq_epi32(dir, _mm_set1_epi32(UP)));
+		__m128i down = _mm_andnot_si128(_mm_cmpeq_epi32(row, lastRow),
+			_mm_cmpeq_epi32(dir, _mm_set1_epi32(DOWN)));
+		__m128i left = _mm_andnot_si128(_mm_cmpeq_epi32(col, one),
+			_mm_cmpeq_epi32(dir, _mm_set1_epi32(LEFT)));
+		__m128i right = _mm_andnot_si128(_mm_cmpeq_epi32(col, lastCol),
+			_mm_cmpeq_epi32(dir, _mm_set1_epi32(RIGHT)));
+		row = _mm_sub_epi32(_mm_add_epi32(row, up), down);
+		col = _mm_sub_epi32(_mm_add_epi32(col, left), right);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(rows + k), row);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(cols + k), col);
+		__m128i moved = _mm_or_si128(_mm_or_si128(up, down), _mm_or_si128(left, right));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(moves + k),
+			_mm_or_si128(_mm_and_si128(moved, dir), _mm_andnot_si128(moved, notMoved)));
+		hits = _mm_or_si128(hits, _mm_and_si128(
+			_mm_cmpeq_epi32(row, playerRows), _mm_cmpeq_epi32(col, playerCols)));
+	}
+	hit = (_mm_movemask_epi8(hits) != 0);
+#endif
+	if (stepSnakesScalar(rows, cols, directionBits, moves, k, n, nRows, nCols,
+			playerRow, playerCol))
+		hit = true;
+	return hit;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Benchmarks
+///////////////////////////////////////////////////////////////////////////
+
+// Play nTicks turns in rows x cols pits of nSnakes snakes, the player
+// moving at random (starting a new pit whenever a game ends), finding
+// snakes through the occupancy grid or by scanning every snake.  Return
+// the time spent in turns, and set state to the last pit's state and
+// nGames to the number of pits played.
+double timeTicks(int rows, int cols, int nSnakes, int nTicks, bool scan,
+	PitState& state, int& nGames)
+{
+	RandomGenerator random(1);
+	Pit* pit = nullptr;
+	nGames = 0;
+	double seconds = 0;
+	for (int t = 0; t < nTicks; t++)
+	{
+		if (pit == nullptr || pit->player()->isDead() || pit->snakeCount() == 0)
+		{
+			delete pit;
+			pit = new Pit(rows, cols, random.next());
+			pit->setScanForSnakes(scan);
+			pit->addPlayer(1 + random.below(rows), 1 + random.below(cols));
+			for (int k = 0; k < nSnakes; k++)
+				pit->addSnake(1 + random.below(rows), 1 + random.below(cols));
+			nGames++;
+		}
+		int dir = random.below(4);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		pit->player()->move(dir);
+		pit->moveSnakes();
+		seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+	pit->saveState(state);
+	delete pit;
+	return seconds;
+}
+
+// For each number of snakes, play nTicks turns with the occupancy grid
+// and then the same turns scanning every snake, as Pit did before it had
+// the grid, and report the time per turn for each and whether the games
+// played out the same.
+void benchmarkTicks(int rows, int cols, const vector<int>& snakeCounts, int nTicks)
+{
+	for (size_t k = 0; k < snakeCounts.size(); k++)
+	{
+		PitState gridState;
+		PitState scanState;
+		int nGridGames;
+		int nScanGames;
+		double gridSeconds = timeTicks(rows, cols, snakeCounts[k], nTicks, false,
+			gridState, nGridGames);
+		double scanSeconds = timeTicks(rows, cols, snakeCounts[k], nTicks, true,
+			scanState, nScanGames);
+		cout << rows << "x" << cols << " pit, " << snakeCounts[k] << " snakes: "
+			<< gridSeconds / nTicks * 1e9 << " ns per turn with the grid, "
+			<< scanSeconds / nTicks * 1e9 << " ns scanning, " << nGridGames
+			<< " games"
+			<< (gridState == scanState && nGridGames == nScanGames ? "" :
+				" (GAMES DIFFER)") << endl;
+	}
+}
+
+// Move nSnakes snakes in a rows x cols pit for nTicks turns, once with
+// stepSnakesScalar and once with stepSnakes on the same random directions,
+// and report the time per snake for each and whether they agree.  Then
+// report the time per snake for all of Pit::moveSnakes.
+void benchmarkStepKernel(int rows, int cols, int nSnakes, int nTicks)
+{
+	RandomGenerator random(1);
+	vector<int> scalarRows(nSnakes);
+	vector<int> scalarCols(nSnakes);
+	for (int k = 0; k < nSnakes; k++)
+	{
+		scalarRows[k] = 1 + random.below(rows);
+		scalarCols[k] = 1 + random.below(cols);
+	}
+	vector<int> vectorRows = scalarRows;
+	vector<int> vectorCols = scalarCols;
+	vector<int> scalarMoves(nSnakes);
+	vector<int> vectorMoves(nSnakes);
+	vector<unsigned long long> directionBits((nSnakes + 31) / 32);
+
+	bool same = true;
+	chrono::steady_clock::duration scalarTime(0);
+	chrono::steady_clock::duration vectorTime(0);
+	for (int t = 0; t < nTicks; t++)
+	{
+		for (size_t w = 0; w < directionBits.size(); w++)
+			directionBits[w] = random.next();
+		int playerRow = 1 + random.below(rows);
+		int playerCol = 1 + random.below(cols);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		bool scalarHit = stepSnakesScalar(scalarRows.data(), scalarCols.data(),
+			directionBits.data(), scalarMoves.data(), 0, nSnakes, rows, cols,
+			playerRow, playerCol);
+		chrono::steady_clock::time_point middle = chrono::steady_clock::now();
+		bool vectorHit = stepSnakes(vectorRows.data(), vectorCols.data(),
+			directionBits.data(), vectorMoves.data(), nSnakes, rows, cols,
+			playerRow, playerCol);
+		scalarTime += middle - start;
+		vectorTime += chrono::steady_clock::now() - middle;
+
+		if (scalarHit != vectorHit || scalarMoves != vectorMoves)
+			same = false;
+	}
+	if (scalarRows != vectorRows || scalarCols != vectorCols)
+		same = false;
+
+	Pit pit(rows, cols, 1);
+	pit.addPlayer(1, 1);
+	for (int k = 0; k < nSnakes; k++)
+		pit.addSnake(scalarRows[k], scalarCols[k]);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int t = 0; t < nTicks; t++)
+		pit.moveSnakes();
+	chrono::steady_clock::duration turnTime = chrono::steady_clock::now() - start;
+
+	double perSnake = 1e9 / (double(nTicks) * nSnakes);
+	cout << rows << "x" << cols << " pit, " << nSnakes << " snakes: "
+		<< chrono::duration<double>(scalarTime).count() * perSnake
+		<< " ns per snake scalar, "
+		<< chrono::duration<double>(vectorTime).count() * perSnake
+		<< " ns vectorized" << (same ? "" : " (RESULTS DIFFER)") << "; "
+		<< chrono::duration<double>(turnTime).count() * perSnake
+		<< " ns per snake for Pit::moveSnakes" << endl;
+}
+
+// Write the pit to cout as Pit::display did before it had a
+// TerminalRenderer:  clear the screen and write every line.
+void displayByRedrawing(const Pit& pit, string msg)
+{
+	vector<string> grid = pit.picture();
+	clearScreen();
+	for (size_t r = 0; r < grid.size(); r++)
+	{
+		for (size_t c = 0; c < grid[r].size(); c++)
+			cout << grid[r][c];
+		cout << endl;
+	}
+	cout << endl;
+	cout << endl;
+	string status = pit.status(msg);
+	for (size_t start = 0; start < status.size(); )
+	{
+		size_t end = status.find('\n', start);
+		cout << status.substr(start, end - start) << endl;
+		start = end + 1;
+	}
+}
+
+// A stream buffer that counts what is written to it and the number of
+// times it is flushed; when it stands in for a terminal's, each flush
+// is a write system call.
+class CountingBuffer : public streambuf
+{
+public:
+	long long bytes = 0;
+	long long flushes = 0;
+
+protected:
+	virtual int overflow(int ch)
+	{
+		if (ch != EOF)
+			bytes++;
+		return ch;
+	}
+	virtual streamsize xsputn(const char*, streamsize n)
+	{
+		bytes += n;
+		return n;
+	}
+	virtual int sync()
+	{
+		flushes++;
+		return 0;
+	}
+};
+
+// Play nFrames turns in a rows x cols pit of nSnakes snakes, the player
+// moving at random, and report the bytes and writes per frame needed to
+// display each turn by redrawing the screen and with a TerminalRenderer.
+void benchmarkDisplay(int rows, int cols, int nSnakes, int nFrames)
+{
+	RandomGenerator random(1);
+	CountingBuffer counter;
+	TerminalRenderer renderer;
+	string frame;
+	long long renderedBytes = 0;
+	Pit* pit = nullptr;
+	streambuf* terminalBuffer = cout.rdbuf(&counter);
+	for (int t = 0; t < nFrames; t++)
+	{
+		if (pit == nullptr || pit->player()->isDead() || pit->snakeCount() == 0)
+		{
+			delete pit;
+			pit = new Pit(rows, cols, random.next());
+			pit->addPlayer(1 + random.below(rows), 1 + random.below(cols));
+			for (int k = 0; k < nSnakes; k++)
+				pit->addSnake(1 + random.below(rows), 1 + random.below(cols));
+		}
+		pit->player()->move(random.below(4));
+		pit->moveSnakes();
+
+		displayByRedrawing(*pit, "");
+		renderer.compose(pit->picture(), pit->status(""), frame);
+		renderedBytes += frame.size();
+	}
+	cout.rdbuf(terminalBuffer);
+	delete pit;
+
+	cout << rows << "x" << cols << " pit, " << nSnakes << " snakes: redrawing sends "
+		<< double(counter.bytes) / nFrames << " bytes in "
+		<< double(counter.flushes) / nFrames << " writes per frame, "
+		<< "the renderer " << double(renderedBytes) / nFrames
+		<< " bytes in 1" << endl;
+}
+
+// Fill a rows x cols TiledPit with nSnakes snakes and a player in the
+// middle, and time nTurns turns on nThreads threads.  Return the seconds
+// taken, and set checksum to the pit's checksum at the end.
+double timeTiledPit(int rows, int cols, int tileSize, int nSnakes, int nTurns,
+	int nThreads, unsigned long long& checksum)
+{
+	RandomGenerator random(1);
+	TiledPit pit(rows, cols, tileSize, tileSize, random.next());
+	pit.addPlayer((rows + 1) / 2, (cols + 1) / 2);
+	for (int k = 0; k < nSnakes; k++)
+		pit.addSnake(1 + random.below(rows), 1 + random.below(cols));
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int t = 0; t < nTurns; t++)
+	{
+		pit.movePlayer(t % 4);
+		pit.moveSnakes(nThreads);
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	checksum = pit.checksum() + pit.snakeCount() + pit.playerRow() * 3 +
+		pit.playerCol() * 5 + pit.isPlayerDead();
+	return seconds;
+}
+
+// Report how TiledPit's speed scales with 1 through maxThreads threads:
+// strong scaling is for one pit of a million snakes; weak scaling gives
+// each thread a quarter of a million snakes and a proportional share of
+// the pit.  Check that every run with the same pit ends the same way, and
+// that the size of the tiles doesn't matter either.
+void benchmarkScaling(int maxThreads)
+{
+	const int SIZE = 2000;
+	const int TILE_SIZE = 250;
+	const int N_SNAKES = 1000000;
+	const int N_TURNS = 20;
+
+	unsigned long long expected;
+	unsigned long long checksum;
+	timeTiledPit(SIZE, SIZE, SIZE, N_SNAKES, N_TURNS, 1, expected);
+	double oneThread = 0;
+	cout << "Strong scaling, " << SIZE << "x" << SIZE << " pit, " << N_SNAKES
+		<< " snakes, " << TILE_SIZE << "x" << TILE_SIZE << " tiles:" << endl;
+	for (int n = 1; n <= maxThreads; n++)
+	{
+		double seconds = timeTiledPit(SIZE, SIZE, TILE_SIZE, N_SNAKES, N_TURNS, n, checksum);
+		if (n == 1)
+			oneThread = seconds;
+		cout << "  " << n << " thread" << (n == 1 ? ": " : "s: ")
+			<< double(N_SNAKES) * N_TURNS / seconds / 1e6 << " million snake moves per second, "
+			<< "speedup " << oneThread / seconds
+			<< (checksum == expected ? "" : " (RESULTS DIFFER)") << endl;
+	}
+
+	cout << "Weak scaling, " << N_SNAKES / 4 << " snakes and "
+		<< SIZE / 4 << "x" << SIZE << " of the pit per thread:" << endl;
+	for (int n = 1; n <= maxThreads; n++)
+	{
+		int rows = SIZE / 4 * n;
+		int nSnakes = N_SNAKES / 4 * n;
+		timeTiledPit(rows, SIZE, max(rows, SIZE), nSnakes, N_TURNS, 1, expected);
+		double seconds = timeTiledPit(rows, SIZE, TILE_SIZE, nSnakes, N_TURNS, n, checksum);
+		if (n == 1)
+			oneThread = seconds;
+		cout << "  " << n << " thread" << (n == 1 ? ": " : "s: ")
+			<< double(nSnakes) * N_TURNS / seconds / 1e6 << " million snake moves per second, "
+			<< "efficiency " << oneThread / seconds
+			<< (checksum == expected ? "" : " (RESULTS DIFFER)") << endl;
+	}
+}
+
+// Set up a pit of either kind as Game's constructor does:  the player at
+// a random position, then nSnakes snakes anywhere else.
+template<typename AnyPit>
+void populate(AnyPit& pit, int nSnakes, RandomGenerator& random)
+{
+	int rPlayer = 1 + random.below(pit.rows());
+	int cPlayer = 1 + random.below(pit.cols());
+	pit.addPlayer(rPlayer, cPlayer);
+	while (nSnakes > 0)
+	{
+		int r = 1 + random.below(pit.rows());
+		int c = 1 + random.below(pit.cols());
+		if (r == rPlayer  &&  c == cPlayer)
+			continue;
+		pit.addSnake(r, c);
+		nSnakes--;
+	}
+}
+
+// The turns a player acting at random survives (up to maxSteps) in a
+// rows x cols pit of nSnakes snakes, played exactly (with a Pit) or with
+// a LodPit
+int survivalExact(int rows, int cols, int nSnakes, int maxSteps, unsigned long long seed)
+{
+	RandomGenerator random(seed);
+	Pit pit(rows, cols, random.next());
+	populate(pit, nSnakes, random);
+	int turns = 0;
+	while (turns < maxSteps && pit.snakeCount() > 0 &&
+		pit.takeTurn("udlr "[random.below(5)]))
+		turns++;
+	return turns;
+}
+
+int survivalLod(int rows, int cols, int nSnakes, int blockSize, int radius,
+	int maxSteps, unsigned long long seed)
+{
+	RandomGenerator random(seed);
+	LodPit pit(rows, cols, blockSize, radius, random.next());
+	populate(pit, nSnakes, random);
+	int turns = 0;
+	while (turns < maxSteps && pit.snakeCount() > 0 &&
+		pit.takeTurn("udlr "[random.below(5)]))
+		turns++;
+	return turns;
+}
+
+// Compare the time per turn of a Pit and a LodPit with the same snakes,
+// in a rows x cols pit with nSnakes snakes, the player acting at random.
+void benchmarkLod(int rows, int cols, int nSnakes, int blockSize, int radius, int nTurns)
+{
+	RandomGenerator random(1);
+	Pit exact(rows, cols, 2);
+	LodPit lod(rows, cols, blockSize, radius, 2);
+	RandomGenerator exactSetup(3);
+	RandomGenerator lodSetup(3);
+	populate(exact, nSnakes, exactSetup);
+	populate(lod, nSnakes, lodSetup);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int t = 0; t < nTurns; t++)
+		exact.takeTurn("udlr "[random.below(5)]);
+	double exactSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	start = chrono::steady_clock::now();
+	for (int t = 0; t < nTurns; t++)
+		lod.takeTurn("udlr "[random.below(5)]);
+	double lodSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << rows << "x" << cols << " pit, " << nSnakes << " snakes: "
+		<< exactSeconds / nTurns * 1e6 << " us per turn exact, "
+		<< lodSeconds / nTurns * 1e6 << " us with levels of detail ("
+		<< blockSize << "x" << blockSize << " blocks, radius " << radius << ", "
+		<< lod.exactSnakeCount() << " exact snakes at the end), "
+		<< exactSeconds / lodSeconds << " times faster" << endl;
+}
+
+// Check that a LodPit plays out like a Pit:  compare the distributions of
+// the turns survived in nGames games of each with a two-sample
+// Kolmogorov-Smirnov test at the 1% level.  Return true if they don't
+// differ significantly.
+bool validateLod(int rows, int cols, int nSnakes, int blockSize, int radius,
+	int maxSteps, int nGames)
+{
+	vector<int> exact(nGames);
+	vector<int> lod(nGames);
+	double exactMean = 0;
+	double lodMean = 0;
+	for (int g = 0; g < nGames; g++)
+	{
+		exact[g] = survivalExact(rows, cols, nSnakes, maxSteps, mixSeed(2 * g));
+		lod[g] = survivalLod(rows, cols, nSnakes, blockSize, radius, maxSteps, mixSeed(2 * g + 1));
+		exactMean += exact[g];
+		lodMean += lod[g];
+	}
+	sort(exact.begin(), exact.end());
+	sort(lod.begin(), lod.end());
+
+	// The greatest difference between the two empirical distributions
+	double d = 0;
+	size_t i = 0;
+	size_t j = 0;
+	while (i < exact.size() && j < lod.size())
+	{
+		int t = min(exact[i], lod[j]);
+		while (i < exact.size() && exact[i] == t)
+			i++;
+		while (j < lod.size() && lod[j] == t)
+			j++;
+		d = max(d, fabs(double(i) - double(j)) / nGames);
+	}
+	double critical = 1.628 * sqrt(2.0 / nGames);
+
+	cout << rows << "x" << cols << " pit, " << nSnakes << " snakes, " << nGames
+		<< " games each:  mean turns survived " << exactMean / nGames << " exact, "
+		<< lodMean / nGames << " with levels of detail; Kolmogorov-Smirnov D = "
+		<< d << " (" << (d <= critical ? "within" : "BEYOND") << " the 1% critical value "
+		<< critical << ")" << endl;
+	return d <= critical;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 //  main()
 ///////////////////////////////////////////////////////////////////////////
 
-int main()
+// Return a new policy of the named kind (see main).
+PlayerPolicy* makePolicy(string name, unsigned long long seed)
+{
+	if (name == "greedy")
+		return new GreedyEscapePolicy;
+	else if (name == "rollout")
+		return new RolloutPolicy(seed);
+	else if (name.substr(0, 8) == "rollout:")
+		return new RolloutPolicy(seed, atoi(name.c_str() + 8));
+	else if (name.substr(0, 7) == "script:")
+		return new ScriptedPolicy(name.substr(7));
+	else
+		return new RandomPolicy(seed);
+}
+
+// The seed for game number game of a series started with seed
+unsigned long long gameSeed(unsigned long long seed, long long game)
+{
+	return mixSeed(seed ^ mixSeed(static_cast<unsigned long long>(game)));
+}
+
+// Play games without a display, the policy choosing the player's moves,
+// and report how they turned out.  Record the first game in recordPath,
+// unless it's empty.
+void runHeadless(int rows, int cols, int nSnakes, int nGames,
+	long long maxSteps, string policyName, unsigned long long seed,
+	string recordPath)
+{
+	long long nSteps = 0;
+	long long nKilled = 0;
+	int nWon = 0;
+	int nLost = 0;
+	long long nNodes = 0;  // totals of RolloutPolicy statistics
+	long long nDecisions = 0;
+	double decisionSeconds = 0;
+	double longestDecision = 0;
+	clock_t start = clock();
+	for (int g = 0; g < nGames; g++)
+	{
+		unsigned long long thisSeed = gameSeed(seed, g);
+		PlayerPolicy* policy = makePolicy(policyName, mixSeed(thisSeed));
+		Game game(rows, cols, nSnakes, thisSeed);
+		ReplayLog log;
+		if (g == 0 && recordPath != "")
+			game.record(&log);
+		GameOutcome outcome = game.simulate(*policy, maxSteps);
+		RolloutPolicy* bot = dynamic_cast<RolloutPolicy*>(policy);
+		if (bot != nullptr)
+		{
+			nNodes += bot->nodes();
+			nDecisions += bot->decisions();
+			decisionSeconds += bot->seconds();
+			longestDecision = max(longestDecision, bot->longestDecision());
+		}
+		delete policy;
+		if (g == 0 && recordPath != "" && !log.save(recordPath))
+			cout << "Can't write replay log " << recordPath << endl;
+		nSteps += outcome.steps;
+		nKilled += outcome.snakesKilled;
+		if (outcome.won)
+			nWon++;
+		if (outcome.lost)
+			nLost++;
+	}
+	double seconds = double(clock() - start) / CLOCKS_PER_SEC;
+
+	cout << nGames << " games: " << nWon << " won, " << nLost << " lost, "
+		<< nGames - nWon - nLost << " unfinished" << endl;
+	cout << "Average steps survived: " << double(nSteps) / nGames << endl;
+	cout << "Average snakes killed: " << double(nKilled) / nGames << endl;
+	if (seconds > 0)
+		cout << "Steps per second: " << nSteps / seconds << endl;
+	if (nDecisions > 0 && decisionSeconds > 0)
+		cout << "Rollouts: " << nNodes / decisionSeconds << " nodes per second, "
+			<< decisionSeconds / nDecisions * 1000 << " ms per decision on average, "
+			<< longestDecision * 1000 << " ms at most" << endl;
+}
+
+// A pit size and number of snakes for runMonteCarlo
+struct MonteCarloConfig
+{
+	int rows;
+	int cols;
+	int nSnakes;
+};
+
+// How a number of games turned out
+struct SurvivalStats
+{
+	long long nGames = 0;
+	long long nWon = 0;
+	long long nLost = 0;
+	vector<long long> nLostAt;  // games lost on each turn (when the player's
+	                            //   age was that number)
+
+	void add(const GameOutcome& outcome)
+	{
+		nGames++;
+		if (outcome.won)
+			nWon++;
+		if (outcome.lost)
+		{
+			nLost++;
+			if (static_cast<int>(nLostAt.size()) <= outcome.steps)
+				nLostAt.resize(outcome.steps + 1, 0);
+			nLostAt[outcome.steps]++;
+		}
+	}
+
+	void merge(const SurvivalStats& other)
+	{
+		nGames += other.nGames;
+		nWon += other.nWon;
+		nLost += other.nLost;
+		if (nLostAt.size() < other.nLostAt.size())
+			nLostAt.resize(other.nLostAt.size(), 0);
+		for (size_t t = 0; t < other.nLostAt.size(); t++)
+			nLostAt[t] += other.nLostAt[t];
+	}
+
+	bool operator==(const SurvivalStats& other) const
+	{
+		return nGames == other.nGames && nWon == other.nWon &&
+			nLost == other.nLost && nLostAt == other.nLostAt;
+	}
+};
+
+// Play gamesPerConfig games of each configuration on nThreads threads.
+// Game g of configuration c is seeded from (seed, c, g) alone, so the
+// results are the same whatever the number of threads.
+vector<SurvivalStats> playMonteCarlo(const vector<MonteCarloConfig>& configs,
+	int gamesPerConfig, long long maxSteps, string policyName,
+	unsigned long long seed, int nThreads)
+{
+	long long nGames = static_cast<long long>(configs.size()) * gamesPerConfig;
+	atomic<long long> nextGame(0);
+	vector<vector<SurvivalStats>> threadStats(nThreads,
+		vector<SurvivalStats>(configs.size()));
+
+	auto work = [&](int t) {
+		const long long BATCH_SIZE = 16;
+		for (;;)
+		{
+			long long first = nextGame.fetch_add(BATCH_SIZE);
+			if (first >= nGames)
+				break;
+			long long last = min(first + BATCH_SIZE, nGames);
+			for (long long g = first; g < last; g++)
+			{
+				int c = static_cast<int>(g / gamesPerConfig);
+				unsigned long long thisSeed = gameSeed(seed + c, g % gamesPerConfig);
+				PlayerPolicy* policy = makePolicy(policyName, mixSeed(thisSeed));
+				Game game(configs[c].rows, configs[c].cols, configs[c].nSnakes, thisSeed);
+				threadStats[t][c].add(game.simulate(*policy, maxSteps));
+				delete policy;
+			}
+		}
+	};
+	vector<thread> workers;
+	for (int t = 1; t < nThreads; t++)
+		workers.push_back(thread(work, t));
+	work(0);
+	for (size_t k = 0; k < workers.size(); k++)
+		workers[k].join();
+
+	vector<SurvivalStats> stats(configs.size());
+	for (int t = 0; t < nThreads; t++)
+		for (size_t c = 0; c < configs.size(); c++)
+			stats[c].merge(threadStats[t][c]);
+	return stats;
+}
+
+// Run the Monte Carlo games with 1 through maxThreads threads, reporting
+// games per second for each, then print a survival curve for each
+// configuration:  the fraction of games in which the player was still
+// alive after each of a series of turns.
+void runMonteCarlo(const vector<MonteCarloConfig>& configs, int gamesPerConfig,
+	long long maxSteps, string policyName, unsigned long long seed, int maxThreads)
+{
+	vector<SurvivalStats> stats;
+	for (int nThreads = 1; nThreads <= maxThreads; nThreads++)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		vector<SurvivalStats> result = playMonteCarlo(configs, gamesPerConfig,
+			maxSteps, policyName, seed, nThreads);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << nThreads << " thread" << (nThreads == 1 ? ": " : "s: ")
+			<< configs.size() * gamesPerConfig / seconds << " games per second";
+		if (stats.empty())
+			stats = result;
+		else if (!(result == stats))
+			cout << " (RESULTS DIFFER FROM 1 THREAD)";
+		cout << endl;
+	}
+
+	for (size_t c = 0; c < configs.size(); c++)
+	{
+		const SurvivalStats& s = stats[c];
+		cout << configs[c].rows << "x" << configs[c].cols << " pit, "
+			<< configs[c].nSnakes << " snakes: " << s.nWon << " won, " << s.nLost
+			<< " lost of " << s.nGames << endl;
+		cout << "  alive after turn:";
+		long long nLostSoFar = 0;
+		size_t t = 0;
+		for (long long checkpoint = 1; checkpoint <= maxSteps; checkpoint *= 2)
+		{
+			for (; t < s.nLostAt.size() && t <= static_cast<size_t>(checkpoint); t++)
+				nLostSoFar += s.nLostAt[t];
+			cout << " " << checkpoint << ":" << 1 - double(nLostSoFar) / s.nGames;
+			if (t >= s.nLostAt.size())
+				break;
+		}
+		cout << endl;
+	}
+}
+
+// Replay a recorded game:  play every turn from the start, checking that
+// the pit ends up as it was recorded, and report the speed.  Then show the
+// pit after the given turn (the last, if turn is negative), reached from
+// the latest snapshot before it.  Return false if the log can't be read or
+// the game didn't replay as recorded.
+bool runReplay(string path, long long turn)
+{
+	ReplayLog log;
+	if (!log.load(path))
+	{
+		cout << "Can't read replay log " << path << endl;
+		return false;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	Pit* pit = log.replay(log.turnCount(), true);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	PitState state;
+	pit->saveState(state);
+	bool same = (state == log.finalState());
+	delete pit;
+	cout << "Replayed " << log.turnCount() << " turns in " << seconds << " s";
+	if (seconds > 0)
+		cout << " (" << log.turnCount() / seconds << " turns per second)";
+	cout << (same ? "" : "; THE PIT DIFFERS FROM THE RECORDING") << endl;
+
+	if (turn < 0 || turn > log.turnCount())
+		turn = log.turnCount();
+	start = chrono::steady_clock::now();
+	pit = log.replay(turn);
+	seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Reached turn " << turn << " in " << seconds * 1000 << " ms" << endl;
+	vector<string> grid = pit->picture();
+	for (size_t r = 0; r < grid.size(); r++)
+		cout << grid[r] << endl;
+	cout << endl << pit->status("");
+	delete pit;
+	return same;
+}
+
+int main(int argc, char* argv[])
 {
-	// Initialize the random number generator.  (You don't need to
-	// understand how this works.)
-	srand(static_cast<unsigned int>(time(0)));
+	// Options:
+	//   --rows=R --cols=C --snakes=N   pit size and number of snakes
+	//   --seed=S                       seed the random number generator
+	//   --headless                     play without a display, using:
+	//     --policy=P                     random, greedy, rollout[:N] (N
+	//                                    rollouts a turn), or script:MOVES
+	//                                    (MOVES from u, d, l, r and .)
+	//     --games=G                      games to play
+	//     --max-steps=M                  turns after which a game stops
+	//   --montecarlo                   play games on many threads, using
+	//                                  --policy, --games and --max-steps and:
+	//     --sizes=RxC,...                pit sizes
+	//     --densities=D,...              fractions of the pit with a snake
+	//     --threads=T                    report speed for 1 through T threads
+	//   --record=FILE                  record the game (with --headless, the
+	//                                  first game) in a replay log
+	//   --replay=FILE                  replay a recorded game, and show:
+	//     --turn=T                       the pit after turn T
+	//   --scaling                      report how a tiled giant pit's speed
+	//                                  scales with up to --threads threads
+	//   --realtime                     play in real time, with:
+	//     --tick-rate=N                  turns a second
+	//     --fps=N                        the most frames drawn a second
+	//     --keys=FILE                    keys from FILE instead of the keyboard
+	//   --lod                          benchmark and validate the level of
+	//                                  detail engine (LodPit)
+	//   --profile=FILE                 (built with SNAKE_PROFILE defined) where
+	//                                  to write the profile, by default
+	//                                  snake-profile.json
+	//   --benchmark                    time turns of games with the occupancy
+	//                                  grid and scanning snakes (benchmarkTicks),
+	//                                  moving a million snakes (benchmarkStepKernel),
+	//                                  and compare ways to display (benchmarkDisplay);
+	//                                  the step kernel moves 4 snakes at a time
+	//                                  with SSE2, or 8 or 16 if built with
+	//                                  -mavx2 or -mavx512f (or -march=native)
+	int rows = 9;
+	int cols = 10;
+	int nSnakes = 40;
+	unsigned long long seed = static_cast<unsigned long long>(time(0));
+	bool headless = false;
+	bool montecarlo = false;
+	bool benchmark = false;
+	bool scaling = false;
+	bool realTime = false;
+	bool lod = false;
+	int tickRate = 4;
+	int frameRate = 30;
+	string keysPath;
+	string sizes = "9x10,20x40";
+	string densities = "0.05,0.2,0.45";
+	int nThreads = static_cast<int>(thread::hardware_concurrency());
+	string policy = "random";
+	int nGames = 1;
+	long long maxSteps = 1000000;
+	string recordPath;
+	string replayPath;
+	long long replayTurn = -1;
+#ifdef SNAKE_PROFILE
+	// Write the profile however main returns
+	struct ProfileDump
+	{
+		string path = "snake-profile.json";
+		~ProfileDump()
+		{
+			if (!profiler().write(path))
+				cout << "Can't write profile " << path << endl;
+		}
+	} profileDump;
+#endif
+	for (int k = 1; k < argc; k++)
+	{
+		string value;
+		if (strcmp(argv[k], "--headless") == 0)
+			headless = true;
+		else if (strcmp(argv[k], "--montecarlo") == 0)
+			montecarlo = true;
+		else if (strcmp(argv[k], "--benchmark") == 0)
+			benchmark = true;
+		else if (strcmp(argv[k], "--scaling") == 0)
+			scaling = true;
+		else if (strcmp(argv[k], "--realtime") == 0)
+			realTime = true;
+		else if (strcmp(argv[k], "--lod") == 0)
+			lod = true;
+		else if (optionValue(argv[k], "tick-rate", value))
+			tickRate = atoi(value.c_str());
+		else if (optionValue(argv[k], "fps", value))
+			frameRate = atoi(value.c_str());
+		else if (optionValue(argv[k], "keys", value))
+			keysPath = value;
+		else if (optionValue(argv[k], "rows", value))
+			rows = atoi(value.c_str());
+		else if (optionValue(argv[k], "cols", value))
+			cols = atoi(value.c_str());
+		else if (optionValue(argv[k], "snakes", value))
+			nSnakes = atoi(value.c_str());
+		else if (optionValue(argv[k], "seed", value))
+			seed = strtoull(value.c_str(), nullptr, 10);
+		else if (optionValue(argv[k], "policy", value))
+			policy = value;
+		else if (optionValue(argv[k], "games", value))
+			nGames = atoi(value.c_str());
+		else if (optionValue(argv[k], "max-steps", value))
+			maxSteps = atoll(value.c_str());
+		else if (optionValue(argv[k], "sizes", value))
+			sizes = value;
+		else if (optionValue(argv[k], "densities", value))
+			densities = value;
+		else if (optionValue(argv[k], "threads", value))
+			nThreads = atoi(value.c_str());
+		else if (optionValue(argv[k], "record", value))
+			recordPath = value;
+		else if (optionValue(argv[k], "replay", value))
+			replayPath = value;
+		else if (optionValue(argv[k], "turn", value))
+			replayTurn = atoll(value.c_str());
+#ifdef SNAKE_PROFILE
+		else if (optionValue(argv[k], "profile", value))
+			profileDump.path = value;
+#endif
+		else
+		{
+			cout << "Unknown option " << argv[k] << endl;
+			return 1;
+		}
+	}
+
+	if (nThreads < 1)
+		nThreads = 1;
+
+	if (benchmark)
+	{
+		benchmarkTicks(rows, cols, { nSnakes }, 1000000);
+		benchmarkTicks(200, 200, { 40, 400, 4000 }, 100000);
+		benchmarkStepKernel(1000, 1000, 1000000, 100);
+		benchmarkDisplay(rows, cols, nSnakes, 10000);
+		return 0;
+	}
+	if (lod)
+	{
+		benchmarkLod(2000, 2000, 1000000, 16, 32, 50);
+		benchmarkLod(500, 500, 25000, 16, 32, 500);
+		return validateLod(128, 128, 300, 8, 16, 1500, 2000) ? 0 : 1;
+	}
+	if (scaling)
+	{
+		benchmarkScaling(nThreads);
+		return 0;
+	}
+	if (headless)
+	{
+		runHeadless(rows, cols, nSnakes, nGames, maxSteps, policy, seed, recordPath);
+		return 0;
+	}
+	if (replayPath != "")
+		return runReplay(replayPath, replayTurn) ? 0 : 1;
+	if (montecarlo)
+	{
+		vector<MonteCarloConfig> configs;
+		for (const char* size = sizes.c_str(); *size != '\0'; )
+		{
+			int r = atoi(size);
+			const char* x = strchr(size, 'x');
+			int c = (x == nullptr ? r : atoi(x + 1));
+			for (const char* d = densities.c_str(); *d != '\0'; )
+			{
+				MonteCarloConfig config = { r, c,
+					static_cast<int>(atof(d) * r * c + 0.5) };
+				configs.push_back(config);
+				d = strchr(d, ',');
+				d = (d == nullptr ? "" : d + 1);
+			}
+			size = strchr(size, ',');
+			size = (size == nullptr ? "" : size + 1);
+		}
+		runMonteCarlo(configs, nGames, maxSteps, policy, seed, nThreads);
+		return 0;
+	}
 
 	// Create a game
-	// Use this instead to create a mini-game:   Game g(3, 3, 2);
-	Game g(9, 10, 40);
+	// Use this instead to create a mini-game:   Game g(3, 3, 2, seed);
+	Game g(rows, cols, nSnakes, seed);
+	ReplayLog log;
+	if (recordPath != "")
+		g.record(&log);
 
 	// Play the game
-	g.play();
+	if (realTime)
+	{
+		KeySource* keys;
+		if (keysPath == "")
+			keys = new TerminalKeys;
+		else
+		{
+			ScriptedKeys* script = new ScriptedKeys;
+			if (!script->load(keysPath))
+			{
+				cout << "Can't read keys from " << keysPath << endl;
+				delete script;
+				return 1;
+			}
+			keys = script;
+		}
+		g.playRealTime(*keys, tickRate, frameRate);
+		delete keys;
+	}
+	else
+		g.play();
+	if (recordPath != "" && !log.save(recordPath))
+	{
+		cout << "Can't write replay log " << recordPath << endl;
+		return 1;
+	}
+	return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,1106 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+// A long-running server for the word-quality scorer, the tune translator
+// and the bill calculator, so that short-lived processes don't each pay to
+// start up and load rules.  Clients connect to a Unix domain socket and
+// send requests in the binary protocol below.  Each round, the server reads
+// whatever requests have arrived from all of its clients, runs them as one
+// batch on a pool of threads, and sends the responses.  Rule sets are
+// compiled once and kept, so loading the same rules again costs a lookup.
+//
+// With --load, the program is instead a load generator:  it runs clients
+// against a server and reports requests per second and latency percentiles.
+//
+// Build from this directory with
+//   g++ -std=c++17 -O2 -pthread -o text-server "Text Server.cpp"
+// and run, say,
+//   ./text-server --socket=/tmp/text.sock --threads=4 &
+//   ./text-server --load --socket=/tmp/text.sock --clients=8 --kind=mix
+
+#ifdef _MSC_VER
+#error "The text server needs Unix domain sockets."
+#endif
+
+// Every header the programs include is included here first, so that
+// including the programs inside namespaces below doesn't put the library
+// inside those namespaces too.
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <csignal>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Allocation Accounting.h"
+#include "Options.h"
+
+namespace phonebill
+{
+#include "Phone Bill Calculator.cpp"
+}
+namespace piano
+{
+#include "Piano Note Converter.cpp"
+}
+namespace wordfinder
+{
+#include "Word Finder.cpp"
+}
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////
+//  Protocol
+///////////////////////////////////////////////////////////////////////////
+
+// Every message is a frame:  a 4-byte size (of the rest of the frame), a
+// 4-byte request id chosen by the client and echoed in the response, a
+// 1-byte kind (in a request) or status (in a response), and a payload.
+// Numbers are in the machine's byte order, since both ends are on one
+// machine.
+//
+//  kind        request payload                  response payload
+//  LOAD_RULES  a 4-byte number of rules, then   rule set id (4 bytes)
+//              for each a 4-byte distance and
+//              its two words, each a 1-byte
+//              length and the characters
+//  QUALITY     rule set id, document            quality (4 bytes)
+//  TRANSLATE   tune                             result and bad beat of
+//                                               translateTune (4 bytes
+//                                               each), instructions
+//  BILL        minutes, texts, month (4 bytes   a BillStatus (4 bytes),
+//              each)                            bill (8-byte double)
+//  STATS       nothing                          requests and batches run
+//                                               (8 bytes each)
+
+enum RequestKind
+{
+	LOAD_RULES = 1, QUALITY, TRANSLATE, BILL, STATS
+};
+
+enum ResponseStatus
+{
+	STATUS_OK, STATUS_BAD_REQUEST, STATUS_NO_SUCH_RULE_SET
+};
+
+// The errors the Phone Bill Calculator reports, other than a missing name
+enum BillStatus
+{
+	BILL_OK, BILL_NEGATIVE_MINUTES, BILL_NEGATIVE_TEXTS, BILL_BAD_MONTH
+};
+
+const size_t FRAME_HEADER_SIZE = 9;  // size, id, and kind or status
+const uint32_t MAX_FRAME_SIZE = 64 << 20;
+
+template<typename T>
+void appendValue(string& s, T value)
+{
+	s.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Take a value from the front of s, returning false if s is too short.
+template<typename T>
+bool takeValue(string_view& s, T& value)
+{
+	if (s.size() < sizeof(value))
+		return false;
+	memcpy(&value, s.data(), sizeof(value));
+	s.remove_prefix(sizeof(value));
+	return true;
+}
+
+void appendFrame(string& out, uint32_t id, uint8_t kindOrStatus,
+	string_view payload)
+{
+	appendValue<uint32_t>(out, uint32_t(FRAME_HEADER_SIZE - 4 + payload.size()));
+	appendValue<uint32_t>(out, id);
+	appendValue<uint8_t>(out, kindOrStatus);
+	out.append(payload.data(), payload.size());
+}
+
+// If buffer starts with a whole frame, set id, kindOrStatus and payload
+// (which refers into buffer) and the frame's whole size, and return true.
+// Set bad if the frame's size is impossible.
+bool parseFrame(string_view buffer, uint32_t& id, uint8_t& kindOrStatus,
+	string_view& payload, size_t& frameSize, bool& bad)
+{
+	bad = false;
+	string_view s = buffer;
+	uint32_t size;
+	if (!takeValue(s, size))
+		return false;
+	if (size < FRAME_HEADER_SIZE - 4 || size > MAX_FRAME_SIZE)
+	{
+		bad = true;
+		return false;
+	}
+	if (s.size() < size)
+		return false;
+	takeValue(s, id);
+	takeValue(s, kindOrStatus);
+	payload = s.substr(0, size - (FRAME_HEADER_SIZE - 4));
+	frameSize = 4 + size;
+	return true;
+}
+
+// The LOAD_RULES payload for a set of rules
+string encodeRules(const vector<int>& distance,
+	const vector<array<char, wordfinder::MAX_WORD_LENGTH + 1>>& word1,
+	const vector<array<char, wordfinder::MAX_WORD_LENGTH + 1>>& word2)
+{
+	string payload;
+	appendValue<uint32_t>(payload, uint32_t(distance.size()));
+	for (size_t k = 0; k < distance.size(); k++)
+	{
+		appendValue<int32_t>(payload, distance[k]);
+		for (const char* w : { word1[k].data(), word2[k].data() })
+		{
+			appendValue<uint8_t>(payload, uint8_t(strlen(w)));
+			payload += w;
+		}
+	}
+	return payload;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Worker pool
+///////////////////////////////////////////////////////////////////////////
+
+// Threads that stay alive between batches.  run hands out tasks 0 through
+// nTasks-1 to the calling thread (worker 0) and the pool's threads
+// (workers 1 through size()-1) and returns when all are done.
+class WorkerPool
+{
+public:
+	WorkerPool(int nThreads);
+	~WorkerPool();
+	int  size() const { return m_nThreads; }
+	void run(size_t nTasks, const function<void(size_t task, int worker)>& task);
+
+private:
+	void work(int worker);
+	void drain(int worker);
+
+	int                m_nThreads;
+	vector<thread>     m_threads;
+	mutex              m_mutex;
+	condition_variable m_started;
+	condition_variable m_finished;
+	long long          m_generation;
+	int                m_nBusy;
+	bool               m_stopping;
+
+	const function<void(size_t, int)>* m_task;
+	size_t             m_nTasks;
+	atomic<size_t>     m_nextTask;
+};
+
+WorkerPool::WorkerPool(int nThreads)
+	: m_nThreads(max(1, nThreads)), m_generation(0), m_nBusy(0),
+	m_stopping(false), m_task(nullptr), m_nTasks(0), m_nextTask(0)
+{
+	for (int w = 1; w < m_nThreads; w++)
+		m_threads.push_back(thread(&WorkerPool::work, this, w));
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_started.notify_all();
+	for (size_t t = 0; t < m_threads.size(); t++)
+		m_threads[t].join();
+}
+
+void WorkerPool::run(size_t nTasks, const function<void(size_t, int)>& task)
+{
+	if (nTasks == 0)
+		return;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_task = &task;
+		m_nTasks = nTasks;
+		m_nextTask = 0;
+		m_nBusy = m_nThreads - 1;
+		m_generation++;
+	}
+	m_started.notify_all();
+	drain(0);
+	unique_lock<mutex> lock(m_mutex);
+	m_finished.wait(lock, [&] { return m_nBusy == 0; });
+}
+
+void WorkerPool::work(int worker)
+{
+	long long generation = 0;
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_started.wait(lock, [&] {
+				return m_stopping || m_generation != generation;
+			});
+			if (m_stopping)
+				return;
+			generation = m_generation;
+		}
+		drain(worker);
+		lock_guard<mutex> lock(m_mutex);
+		if (--m_nBusy == 0)
+			m_finished.notify_one();
+	}
+}
+
+void WorkerPool::drain(int worker)
+{
+	for (;;)
+	{
+		size_t k = m_nextTask.fetch_add(1);
+		if (k >= m_nTasks)
+			break;
+		(*m_task)(k, worker);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Server
+///////////////////////////////////////////////////////////////////////////
+
+struct Job
+{
+	unsigned long long connection;  // serial number of the client's
+	uint32_t           id;
+	uint8_t            kind;
+	string             payload;
+	uint32_t           ruleSet;     // for LOAD_RULES and QUALITY
+	bool               compile;     // LOAD_RULES of rules not seen before
+	string             response;    // the whole frame
+};
+
+// A rule set, kept for as long as the server runs.  rules is null until
+// the set is compiled, and stays null if the LOAD_RULES payload was bad.
+struct CachedRuleSet
+{
+	unique_ptr<wordfinder::CompiledRuleSet> rules;
+};
+
+// What a worker keeps from one QUALITY request to the next:  a batch's
+// requests are sorted by rule set, so a worker usually scores its next
+// document against the same rules and can reuse the scorer.
+struct WorkerState
+{
+	const wordfinder::CompiledRuleSet*   rules = nullptr;
+	unique_ptr<wordfinder::DocumentScorer> scorer;
+};
+
+class TextServer
+{
+public:
+	// Run at most maxBatch requests together, and wait up to batchWaitMs
+	// milliseconds after the first request of a batch for more to arrive.
+	TextServer(int nThreads, int maxBatch, int batchWaitMs);
+	~TextServer();
+
+	bool listen(string path);
+	void serve(const volatile sig_atomic_t& stopping);
+
+private:
+	struct Connection
+	{
+		int    fd;
+		string in;
+		string out;
+	};
+	typedef unordered_map<unsigned long long, Connection> ConnectionMap;
+
+	void acceptConnections();
+	bool readFrom(unsigned long long serial, Connection& c);
+	bool writeTo(Connection& c);
+	void addJob(unsigned long long serial, uint32_t id, uint8_t kind,
+		string_view payload);
+	void runBatch();
+	void compileRules(Job& job);
+	void execute(Job& job, WorkerState& state);
+
+	TextServer(const TextServer&) = delete;
+	TextServer& operator=(const TextServer&) = delete;
+
+	WorkerPool          m_pool;
+	vector<WorkerState> m_workerStates;
+	size_t              m_maxBatch;
+	int                 m_batchWaitMs;
+
+	string              m_path;
+	int                 m_listenFd;
+	ConnectionMap       m_connections;
+	unsigned long long  m_nextSerial;
+
+	vector<Job>         m_batch;
+	unordered_map<string, uint32_t> m_ruleSetIds;  // by LOAD_RULES payload
+	vector<unique_ptr<CachedRuleSet>> m_ruleSets;  // by id
+	unsigned long long  m_nRequests;
+	unsigned long long  m_nBatches;
+};
+
+TextServer::TextServer(int nThreads, int maxBatch, int batchWaitMs)
+	: m_pool(nThreads), m_workerStates(m_pool.size()),
+	m_maxBatch(max(1, maxBatch)), m_batchWaitMs(max(0, batchWaitMs)),
+	m_listenFd(-1), m_nextSerial(0), m_nRequests(0), m_nBatches(0)
+{
+}
+
+TextServer::~TextServer()
+{
+	for (ConnectionMap::iterator p = m_connections.begin();
+			p != m_connections.end(); p++)
+		close(p->second.fd);
+	if (m_listenFd >= 0)
+	{
+		close(m_listenFd);
+		unlink(m_path.c_str());
+	}
+}
+
+bool TextServer::listen(string path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		return false;
+	strcpy(address.sun_path, path.c_str());
+
+	m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_listenFd < 0)
+		return false;
+	unlink(path.c_str());  // left by a server that didn't shut down
+	m_path = path;
+	if (bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+			::listen(m_listenFd, SOMAXCONN) < 0)
+		return false;
+	fcntl(m_listenFd, F_SETFL, fcntl(m_listenFd, F_GETFL) | O_NONBLOCK);
+	return true;
+}
+
+void TextServer::serve(const volatile sig_atomic_t& stopping)
+{
+	chrono::steady_clock::time_point batchDeadline;
+	vector<pollfd> fds;
+	vector<unsigned long long> serials;  // of the connection at fds[k+1]
+	while (!stopping)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (!m_batch.empty() &&
+				(m_batch.size() >= m_maxBatch || now >= batchDeadline))
+			runBatch();
+
+		// Wake up at the batch deadline, or now and then to check stopping.
+		int timeout = 100;
+		if (!m_batch.empty())
+			timeout = int(chrono::duration_cast<chrono::milliseconds>(
+				batchDeadline - now).count()) + 1;
+
+		fds.clear();
+		serials.clear();
+		pollfd listenPoll = { m_listenFd, POLLIN, 0 };
+		fds.push_back(listenPoll);
+		for (ConnectionMap::iterator p = m_connections.begin();
+				p != m_connections.end(); p++)
+		{
+			pollfd connectionPoll = { p->second.fd,
+				short(POLLIN | (p->second.out.empty() ? 0 : POLLOUT)), 0 };
+			fds.push_back(connectionPoll);
+			serials.push_back(p->first);
+		}
+		if (poll(fds.data(), fds.size(), timeout) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			cerr << "poll failed: " << strerror(errno) << endl;
+			return;
+		}
+
+		bool wasEmpty = m_batch.empty();
+		if (fds[0].revents & POLLIN)
+			acceptConnections();
+		for (size_t k = 1; k < fds.size(); k++)
+		{
+			if (fds[k].revents == 0)
+				continue;
+			ConnectionMap::iterator p = m_connections.find(serials[k - 1]);
+			bool open = true;
+			if (fds[k].revents & (POLLIN | POLLHUP | POLLERR))
+				open = readFrom(p->first, p->second);
+			if (open && (fds[k].revents & POLLOUT))
+				open = writeTo(p->second);
+			if (!open)
+			{
+				close(p->second.fd);
+				m_connections.erase(p);
+			}
+		}
+		if (wasEmpty && !m_batch.empty())
+			batchDeadline = chrono::steady_clock::now() +
+				chrono::milliseconds(m_batchWaitMs);
+	}
+}
+
+void TextServer::acceptConnections()
+{
+	for (;;)
+	{
+		int fd = accept(m_listenFd, nullptr, nullptr);
+		if (fd < 0)
+			return;
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		Connection c = { fd, string(), string() };
+		m_connections[m_nextSerial++] = c;
+	}
+}
+
+// Read what the client has sent and make jobs of its whole requests,
+// returning false if the connection should be closed.
+bool TextServer::readFrom(unsigned long long serial, Connection& c)
+{
+	char buffer[1 << 16];
+	for (;;)
+	{
+		ssize_t n = read(c.fd, buffer, sizeof(buffer));
+		if (n > 0)
+			c.in.append(buffer, n);
+		else if (n == 0)
+			return false;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+		else if (errno != EINTR)
+			return false;
+	}
+
+	size_t used = 0;
+	for (;;)
+	{
+		uint32_t id;
+		uint8_t kind;
+		string_view payload;
+		size_t frameSize;
+		bool bad;
+		if (!parseFrame(string_view(c.in).substr(used), id, kind, payload,
+				frameSize, bad))
+		{
+			c.in.erase(0, used);
+			return !bad;
+		}
+		addJob(serial, id, kind, payload);
+		used += frameSize;
+	}
+}
+
+bool TextServer::writeTo(Connection& c)
+{
+	while (!c.out.empty())
+	{
+		ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+		if (n > 0)
+			c.out.erase(0, n);
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else
+			return false;
+	}
+	return true;
+}
+
+void TextServer::addJob(unsigned long long serial, uint32_t id, uint8_t kind,
+	string_view payload)
+{
+	Job job;
+	job.connection = serial;
+	job.id = id;
+	job.kind = kind;
+	job.payload = string(payload);
+	job.ruleSet = 0;
+	job.compile = false;
+
+	if (kind == LOAD_RULES)
+	{
+		unordered_map<string, uint32_t>::iterator p = m_ruleSetIds.find(job.payload);
+		if (p != m_ruleSetIds.end())
+			job.ruleSet = p->second;
+		else
+		{
+			job.ruleSet = uint32_t(m_ruleSets.size());
+			job.compile = true;
+			m_ruleSets.push_back(unique_ptr<CachedRuleSet>(new CachedRuleSet));
+			m_ruleSetIds[job.payload] = job.ruleSet;
+		}
+	}
+	else if (kind == QUALITY)
+	{
+		string_view s(job.payload);
+		if (!takeValue(s, job.ruleSet))
+			job.ruleSet = uint32_t(-1);
+	}
+	m_batch.push_back(move(job));
+}
+
+void TextServer::runBatch()
+{
+	m_nBatches++;
+	m_nRequests += m_batch.size();
+
+	// New rule sets are compiled first, since later requests in the batch
+	// may use them.  The rest are sorted so requests for the same rule set
+	// are together.
+	vector<Job*> compiles;
+	vector<Job*> others;
+	for (Job& job : m_batch)
+		(job.compile ? compiles : others).push_back(&job);
+	m_pool.run(compiles.size(), [&](size_t k, int) { compileRules(*compiles[k]); });
+	stable_sort(others.begin(), others.end(), [](const Job* a, const Job* b) {
+		return a->kind != b->kind ? a->kind < b->kind : a->ruleSet < b->ruleSet;
+	});
+	m_pool.run(others.size(), [&](size_t k, int worker) {
+		execute(*others[k], m_workerStates[worker]);
+	});
+
+	// Responses go out in the order the requests came in.  A client that
+	// has gone away meanwhile doesn't get them.
+	for (Job& job : m_batch)
+	{
+		ConnectionMap::iterator p = m_connections.find(job.connection);
+		if (p != m_connections.end())
+			p->second.out += job.response;
+	}
+	m_batch.clear();
+	for (ConnectionMap::iterator p = m_connections.begin(); p != m_connections.end(); )
+	{
+		if (!writeTo(p->second))
+		{
+			close(p->second.fd);
+			p = m_connections.erase(p);
+		}
+		else
+			p++;
+	}
+}
+
+void TextServer::compileRules(Job& job)
+{
+	using wordfinder::MAX_WORD_LENGTH;
+	typedef char RuleWord[MAX_WORD_LENGTH + 1];
+
+	string_view s(job.payload);
+	uint32_t nRules;
+	bool ok = takeValue(s, nRules) && nRules <= s.size() / 6;
+	vector<int> distance(ok ? nRules : 0);
+	vector<array<char, MAX_WORD_LENGTH + 1>> word1(distance.size());
+	vector<array<char, MAX_WORD_LENGTH + 1>> word2(distance.size());
+	for (size_t k = 0; ok && k < distance.size(); k++)
+	{
+		int32_t d = 0;
+		ok = takeValue(s, d);
+		distance[k] = d;
+		for (char* w : { word1[k].data(), word2[k].data() })
+		{
+			uint8_t length;
+			ok = ok && takeValue(s, length) && length <= MAX_WORD_LENGTH &&
+				length <= s.size();
+			if (ok)
+			{
+				memcpy(w, s.data(), length);
+				w[length] = '\0';
+				s.remove_prefix(length);
+			}
+		}
+	}
+	if (!ok || !s.empty())
+	{
+		job.response.clear();
+		appendFrame(job.response, job.id, STATUS_BAD_REQUEST, string_view());
+		return;
+	}
+
+	int n = wordfinder::standardizeRules(distance.data(),
+		reinterpret_cast<RuleWord*>(word1.data()),
+		reinterpret_cast<RuleWord*>(word2.data()), int(distance.size()));
+	m_ruleSets[job.ruleSet]->rules.reset(new wordfinder::CompiledRuleSet(
+		distance.data(), reinterpret_cast<const RuleWord*>(word1.data()),
+		reinterpret_cast<const RuleWord*>(word2.data()), n));
+	string payload;
+	appendValue<uint32_t>(payload, job.ruleSet);
+	appendFrame(job.response, job.id, STATUS_OK, payload);
+}
+
+void TextServer::execute(Job& job, WorkerState& state)
+{
+	string_view s(job.payload);
+	string payload;
+	uint8_t status = STATUS_OK;
+	switch (job.kind)
+	{
+	case LOAD_RULES:  // of rules already compiled (or found bad)
+		if (m_ruleSets[job.ruleSet]->rules == nullptr)
+			status = STATUS_BAD_REQUEST;
+		else
+			appendValue<uint32_t>(payload, job.ruleSet);
+		break;
+	case QUALITY:
+	{
+		if (job.ruleSet >= m_ruleSets.size() ||
+				m_ruleSets[job.ruleSet]->rules == nullptr)
+		{
+			status = STATUS_NO_SUCH_RULE_SET;
+			break;
+		}
+		const wordfinder::CompiledRuleSet* rules = m_ruleSets[job.ruleSet]->rules.get();
+		if (state.rules != rules)
+		{
+			state.scorer.reset(new wordfinder::DocumentScorer(*rules));
+			state.rules = rules;
+		}
+		s.remove_prefix(4);
+		appendValue<int32_t>(payload, state.scorer->score(s.data(), s.size()));
+		break;
+	}
+	case TRANSLATE:
+	{
+		string instructions;
+		int badBeat = 0;
+		int result = piano::translateTune(string(s), instructions, badBeat);
+		appendValue<int32_t>(payload, result);
+		appendValue<int32_t>(payload, badBeat);
+		payload += instructions;
+		break;
+	}
+	case BILL:
+	{
+		int32_t minutes, texts, month;
+		if (!takeValue(s, minutes) || !takeValue(s, texts) ||
+				!takeValue(s, month) || !s.empty())
+		{
+			status = STATUS_BAD_REQUEST;
+			break;
+		}
+		int32_t billStatus = BILL_OK;
+		double bill = 0;
+		if (minutes < 0)
+			billStatus = BILL_NEGATIVE_MINUTES;
+		else if (texts < 0)
+			billStatus = BILL_NEGATIVE_TEXTS;
+		else if (month >= 13 || month <= 0)
+			billStatus = BILL_BAD_MONTH;
+		else
+			bill = phonebill::computeBill(minutes, texts, month);
+		appendValue<int32_t>(payload, billStatus);
+		appendValue<double>(payload, bill);
+		break;
+	}
+	case STATS:
+		appendValue<uint64_t>(payload, m_nRequests);
+		appendValue<uint64_t>(payload, m_nBatches);
+		break;
+	default:
+		status = STATUS_BAD_REQUEST;
+		break;
+	}
+	appendFrame(job.response, job.id, status, payload);
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  Client and load generator
+///////////////////////////////////////////////////////////////////////////
+
+class ServerConnection
+{
+public:
+	ServerConnection();
+	~ServerConnection();
+	bool open(string path);
+	bool send(uint32_t id, uint8_t kind, string_view payload);
+
+	// Wait for the next response, returning false if the connection fails.
+	bool receive(uint32_t& id, uint8_t& status, string& payload);
+
+private:
+	ServerConnection(const ServerConnection&) = delete;
+	ServerConnection& operator=(const ServerConnection&) = delete;
+
+	int    m_fd;
+	string m_in;
+	string m_out;
+};
+
+ServerConnection::ServerConnection()
+	: m_fd(-1)
+{
+}
+
+ServerConnection::~ServerConnection()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+bool ServerConnection::open(string path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		return false;
+	strcpy(address.sun_path, path.c_str());
+	m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	return m_fd >= 0 &&
+		connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+}
+
+bool ServerConnection::send(uint32_t id, uint8_t kind, string_view payload)
+{
+	m_out.clear();
+	appendFrame(m_out, id, kind, payload);
+	for (size_t sent = 0; sent < m_out.size(); )
+	{
+		ssize_t n = ::send(m_fd, m_out.data() + sent, m_out.size() - sent,
+			MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		sent += n;
+	}
+	return true;
+}
+
+bool ServerConnection::receive(uint32_t& id, uint8_t& status, string& payload)
+{
+	for (;;)
+	{
+		string_view frame;
+		size_t frameSize;
+		bool bad;
+		if (parseFrame(m_in, id, status, frame, frameSize, bad))
+		{
+			payload = string(frame);
+			m_in.erase(0, frameSize);
+			return true;
+		}
+		if (bad)
+			return false;
+		char buffer[1 << 16];
+		ssize_t n = read(m_fd, buffer, sizeof(buffer));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		m_in.append(buffer, n);
+	}
+}
+
+// A well-formed tune of nBeats beats, each of zero to three notes
+string makeRandomTune(mt19937& gen, int nBeats)
+{
+	uniform_int_distribution<int> notes(0, 3);
+	uniform_int_distribution<int> letter(0, 6);
+	uniform_int_distribution<int> accidental(0, 3);
+	uniform_int_distribution<int> octave(1, 5);
+	string tune;
+	for (int b = 0; b < nBeats; b++)
+	{
+		for (int n = notes(gen); n > 0; n--)
+		{
+			tune += char('A' + letter(gen));
+			int a = accidental(gen);
+			if (a < 2)
+				tune += "#b"[a];
+			int o = octave(gen);
+			if (o > 1)
+				tune += char('0' + o);
+		}
+		tune += '/';
+	}
+	return tune;
+}
+
+struct LoadConfig
+{
+	string path;
+	int    nClients;
+	int    nRequests;  // per client
+	int    depth;      // requests each client keeps outstanding
+	string kind;       // quality, translate, bill or mix
+	int    nRules;
+	int    documentWords;
+};
+
+// The requests the clients send, made from fixed seeds
+struct LoadInputs
+{
+	string         rules;      // LOAD_RULES payload
+	vector<string> documents;
+	vector<string> tunes;
+	vector<string> bills;      // BILL payloads
+};
+
+LoadInputs makeLoadInputs(const LoadConfig& config)
+{
+	const int N_INPUTS = 64;
+	mt19937 gen(1);
+	LoadInputs inputs;
+	vector<string> vocab = wordfinder::makeRandomVocabulary(gen, 2000);
+	vector<int> distance;
+	vector<array<char, wordfinder::MAX_WORD_LENGTH + 1>> word1, word2;
+	wordfinder::makeRandomRules(gen, vocab, config.nRules, 10, distance, word1, word2);
+	inputs.rules = encodeRules(distance, word1, word2);
+
+	uniform_int_distribution<int> minutes(0, 1000);
+	uniform_int_distribution<int> texts(0, 600);
+	uniform_int_distribution<int> month(1, 12);
+	for (int k = 0; k < N_INPUTS; k++)
+	{
+		inputs.documents.push_back(
+			wordfinder::makeRandomDocument(gen, vocab, config.documentWords));
+		inputs.tunes.push_back(makeRandomTune(gen, 32));
+		string bill;
+		appendValue<int32_t>(bill, minutes(gen));
+		appendValue<int32_t>(bill, texts(gen));
+		appendValue<int32_t>(bill, month(gen));
+		inputs.bills.push_back(bill);
+	}
+	return inputs;
+}
+
+// Send one client's requests, adding each one's latency in microseconds
+// to latencies, and return the number that failed.
+int runClient(const LoadConfig& config, const LoadInputs& inputs,
+	vector<double>& latencies)
+{
+	ServerConnection server;
+	if (!server.open(config.path))
+		return config.nRequests;
+
+	uint32_t id;
+	uint8_t status;
+	string response;
+	uint32_t ruleSet = 0;
+	if (config.kind == "quality" || config.kind == "mix")
+	{
+		if (!server.send(0, LOAD_RULES, inputs.rules) ||
+				!server.receive(id, status, response) || status != STATUS_OK)
+			return config.nRequests;
+		memcpy(&ruleSet, response.data(), sizeof(ruleSet));
+	}
+
+	vector<chrono::steady_clock::time_point> sent(config.nRequests);
+	int nSent = 0;
+	int nReceived = 0;
+	int nFailed = 0;
+	string payload;
+	while (nReceived < config.nRequests)
+	{
+		while (nSent < config.nRequests && nSent - nReceived < config.depth)
+		{
+			int kind = config.kind == "quality" ? QUALITY :
+				config.kind == "translate" ? TRANSLATE :
+				config.kind == "bill" ? BILL : QUALITY + nSent % 3;
+			size_t input = nSent % inputs.tunes.size();
+			payload.clear();
+			if (kind == QUALITY)
+			{
+				appendValue<uint32_t>(payload, ruleSet);
+				payload += inputs.documents[input];
+			}
+			else if (kind == TRANSLATE)
+				payload = inputs.tunes[input];
+			else
+				payload = inputs.bills[input];
+			sent[nSent] = chrono::steady_clock::now();
+			if (!server.send(nSent, kind, payload))
+				return nFailed + config.nRequests - nReceived;
+			nSent++;
+		}
+		if (!server.receive(id, status, response) || id >= uint32_t(nSent))
+			return nFailed + config.nRequests - nReceived;
+		latencies.push_back(chrono::duration<double, micro>(
+			chrono::steady_clock::now() - sent[id]).count());
+		if (status != STATUS_OK)
+			nFailed++;
+		nReceived++;
+	}
+	return nFailed;
+}
+
+void runLoad(const LoadConfig& config)
+{
+	LoadInputs inputs = makeLoadInputs(config);
+
+	vector<vector<double>> latencies(config.nClients);
+	vector<int> nFailed(config.nClients);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<thread> clients;
+	for (int c = 0; c < config.nClients; c++)
+		clients.push_back(thread([&, c] {
+			nFailed[c] = runClient(config, inputs, latencies[c]);
+		}));
+	for (size_t c = 0; c < clients.size(); c++)
+		clients[c].join();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	vector<double> all;
+	int failures = 0;
+	for (int c = 0; c < config.nClients; c++)
+	{
+		all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+		failures += nFailed[c];
+	}
+	sort(all.begin(), all.end());
+	auto percentile = [&](double p) {
+		return all.empty() ? 0.0 : all[min(all.size() - 1, size_t(p / 100 * all.size()))];
+	};
+	cout << all.size() << " " << config.kind << " requests from " << config.nClients
+		<< " clients (" << config.depth << " outstanding each) in " << seconds
+		<< " s: " << all.size() / seconds << " requests/s, latency p50 "
+		<< percentile(50) << " us, p99 " << percentile(99) << " us, max "
+		<< (all.empty() ? 0.0 : all.back()) << " us";
+	if (failures > 0)
+		cout << ", " << failures << " FAILED";
+	cout << endl;
+
+	ServerConnection server;
+	uint32_t id;
+	uint8_t status;
+	string response;
+	if (server.open(config.path) && server.send(0, STATS, string_view()) &&
+			server.receive(id, status, response) && response.size() == 16)
+	{
+		uint64_t nRequests, nBatches;
+		memcpy(&nRequests, response.data(), 8);
+		memcpy(&nBatches, response.data() + 8, 8);
+		cout << "server: " << nRequests << " requests in " << nBatches
+			<< " batches (" << double(nRequests) / max<uint64_t>(nBatches, 1)
+			<< " per batch)" << endl;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+//  main
+///////////////////////////////////////////////////////////////////////////
+
+volatile sig_atomic_t stopping = 0;
+
+void stop(int)
+{
+	stopping = 1;
+}
+
+int main(int argc, char* argv[])
+{
+	// Options:
+	//   --socket=PATH       the server's socket (default /tmp/text-server.sock)
+	//   --threads=T         threads running batches (default 4)
+	//   --max-batch=N       requests run together at most (default 1024)
+	//   --batch-wait=MS     time to wait for more requests to join a batch
+	//                       (default 0:  run whatever has arrived)
+	//   --load              run clients against a server instead, using:
+	//     --clients=C         client connections (default 8)
+	//     --requests=N        requests per client (default 10000)
+	//     --depth=D           requests each client keeps outstanding
+	//                         (default 1)
+	//     --kind=K            quality, translate, bill or mix (default)
+	//     --rules=R           rules in the rule set (default 1000)
+	//     --words=W           words per document (default 200)
+	string path = "/tmp/text-server.sock";
+	int nThreads = 4;
+	int maxBatch = 1024;
+	int batchWaitMs = 0;
+	bool load = false;
+	LoadConfig config = { "", 8, 10000, 1, "mix", 1000, 200 };
+	for (int k = 1; k < argc; k++)
+	{
+		string value;
+		if (strcmp(argv[k], "--load") == 0)
+			load = true;
+		else if (optionValue(argv[k], "socket", value))
+			path = value;
+		else if (optionValue(argv[k], "threads", value))
+			nThreads = atoi(value.c_str());
+		else if (optionValue(argv[k], "max-batch", value))
+			maxBatch = atoi(value.c_str());
+		else if (optionValue(argv[k], "batch-wait", value))
+			batchWaitMs = atoi(value.c_str());
+		else if (optionValue(argv[k], "clients", value))
+			config.nClients = atoi(value.c_str());
+		else if (optionValue(argv[k], "requests", value))
+			config.nRequests = atoi(value.c_str());
+		else if (optionValue(argv[k], "depth", value))
+			config.depth = atoi(value.c_str());
+		else if (optionValue(argv[k], "kind", value))
+			config.kind = value;
+		else if (optionValue(argv[k], "rules", value))
+			config.nRules = atoi(value.c_str());
+		else if (optionValue(argv[k], "words", value))
+			config.documentWords = atoi(value.c_str());
+		else
+		{
+			cout << "Unknown option " << argv[k] << endl;
+			exit(1);
+		}
+	}
+
+	if (load)
+	{
+		if (config.nClients < 1 || config.nRequests < 1 || config.depth < 1 ||
+			config.nRules < 1 || config.documentWords < 1 ||
+			(config.kind != "quality" && config.kind != "translate" &&
+			 config.kind != "bill" && config.kind != "mix"))
+		{
+			cout << "Bad load options." << endl;
+			exit(1);
+		}
+		config.path = path;
+		runLoad(config);
+		return 0;
+	}
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	TextServer server(nThreads, maxBatch, batchWaitMs);
+	if (!server.listen(path))
+	{
+		cout << "Cannot listen on " << path << ": " << strerror(errno) << endl;
+		exit(1);
+	}
+	server.serve(stopping);
+	return 0;
+}
@@ -2,6 +2,34 @@
 
 #include <cstring>
 #include <cctype>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <array>
+#include <string_view>
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "Allocation Accounting.h"
 using namespace std;
 
 const int MAX_WORD_LENGTH = 20;
@@ -23,42 +51,91 @@ bool standardizeWord(char s[])
 	return true;  // Everything was OK
 }
 
-bool isPairSame(const char aw1[], const char aw2[], const char bw1[], const char bw2[])
+// What standardizeRules did to a set of rules
+struct RuleStandardizationStats
 {
-	return (strcmp(aw1, bw1) == 0 && strcmp(aw2, bw2) == 0);
-}
+	int nInvalid = 0;          // rules eliminated for a bad distance or word
+	int nDuplicates = 0;       // rules eliminated for repeating an earlier pair
+	int nDistancesRaised = 0;  // duplicates whose distance replaced the earlier
+	                           //   rule's smaller one
+};
+
+// The two words of a rule in alphabetical order, so that rules with the
+// same words in either order have equal keys.
+struct RuleWordPair
+{
+	string_view first;
+	string_view second;
+
+	RuleWordPair(const char w1[], const char w2[])
+		: first(w1), second(w2)
+	{
+		if (second < first)
+			swap(first, second);
+	}
+
+	bool operator==(const RuleWordPair& other) const
+	{
+		return first == other.first && second == other.second;
+	}
+};
+
+struct RuleWordPairHash
+{
+	size_t operator()(const RuleWordPair& p) const
+	{
+		size_t h = hash<string_view>()(p.first);
+		return h ^ (hash<string_view>()(p.second) + 0x9e3779b9 +
+			(h << 6) + (h >> 2));
+	}
+};
 
 int standardizeRules(int distance[],
 	char word1[][MAX_WORD_LENGTH + 1],
 	char word2[][MAX_WORD_LENGTH + 1],
-	int nRules)
+	int nRules,
+	RuleStandardizationStats* stats = nullptr)
 {
+	ALLOCATION_SCOPE("standardizeRules");
 	if (nRules < 0)
 		return 0;
+	RuleStandardizationStats counts;
+
+	// For the pair of words of each rule retained so far, the position of
+	// that rule.  The keys refer to the words in the arrays themselves,
+	// which is safe since a retained rule is never moved.
+	unordered_map<RuleWordPair, int, RuleWordPairHash> retained;
+	retained.reserve(nRules);
+
 	int c = 0;
 	while (c < nRules)
 	{
 		bool eliminateThisRule = false;
 		if (distance[c] <= 0 || !standardizeWord(word1[c]) ||
 			!standardizeWord(word2[c]))
+		{
 			eliminateThisRule = true;
+			counts.nInvalid++;
+		}
 		else
 		{
 			// Does an earlier rule have the same words?  (There will
 			// be at most one, since we will have previously eliminated
 			// others.)
-			for (int c2 = 0; c2 < c; c2++)
+			pair<unordered_map<RuleWordPair, int, RuleWordPairHash>::iterator, bool>
+				result = retained.insert(make_pair(RuleWordPair(word1[c], word2[c]), c));
+			if (!result.second)
 			{
-				if (isPairSame(word1[c2], word2[c2], word1[c], word2[c]) ||
-					isPairSame(word1[c2], word2[c2], word2[c], word1[c]))
+				// Words match, so retain in the earlier position the
+				// rule with the greater distance.
+				int c2 = result.first->second;
+				if (distance[c2] < distance[c])
 				{
-					// Words match, so retain in position c2 the rule
-					// with the greater distance.
-					if (distance[c2] < distance[c])
-						distance[c2] = distance[c];
-					eliminateThisRule = true;
-					break;
+					distance[c2] = distance[c];
+					counts.nDistancesRaised++;
 				}
+				eliminateThisRule = true;
+				counts.nDuplicates++;
 			}
 		}
 		if (eliminateThisRule)
@@ -66,22 +143,42 @@ int standardizeRules(int distance[],
 			// Copy the last rule into this one.  Don't increment c,
 			// so that we examine that rule on the next iteration.
 			nRules--;
-			distance[c] = distance[nRules];
-			strcpy(word1[c], word1[nRules]);
-			strcpy(word2[c], word2[nRules]);
+			if (c != nRules)
+			{
+				distance[c] = distance[nRules];
+				strcpy(word1[c], word1[nRules]);
+				strcpy(word2[c], word2[nRules]);
+			}
 		}
 		else // go on to the next rule
 			c++;
 	}
+	if (stats != nullptr)
+		*stats = counts;
 	return nRules;
 }
 
+int determineQualityOfText(const int distance[],
+	const char word1[][MAX_WORD_LENGTH + 1],
+	const char word2[][MAX_WORD_LENGTH + 1],
+	int nRules,
+	const char document[],
+	size_t length);
+
 int determineQuality(const int distance[],
 	const char word1[][MAX_WORD_LENGTH + 1],
 	const char word2[][MAX_WORD_LENGTH + 1],
 	int nRules,
 	const char document[])
 {
+	ALLOCATION_SCOPE("determineQuality");
+	// A document too long for the fixed-size arrays below is handled by
+	// the one-pass scorer instead.
+	size_t length = strlen(document);
+	if (length > MAX_DOCUMENT_LENGTH)
+		return determineQualityOfText(distance, word1, word2, nRules,
+			document, length);
+
 	// Get document words
 
 	// There can't be more than this many words.  (Worst case is a
@@ -162,4 +259,1645 @@ int determineQuality(const int distance[],
 		}
 	}
 	return nMatches;
-}
\ No newline at end of file
+}
+
+// An inverted index of a document:  for each distinct document word, the
+// positions (in increasing order) at which that word occurs.
+struct DocumentIndex
+{
+	unordered_map<string, vector<int>> positions;
+	int nWords = 0;
+};
+
+// Break the document into words exactly as determineQuality does, and
+// record the position of each word.  Unlike determineQuality, there is no
+// limit on the length of the document.
+void indexDocument(const char document[], DocumentIndex& index)
+{
+	ALLOCATION_SCOPE("indexDocument");
+	index.positions.clear();
+	index.nWords = 0;
+	string word;
+	for (int pos = 0; ; pos++)
+	{
+		char ch = document[pos];
+		if (isalpha(ch))
+		{
+			// As in determineQuality, keep only enough of a long word to
+			// ensure it can't match a rule word.
+			if (word.size() < MAX_WORD_LENGTH + 1)
+				word += static_cast<char>(tolower(ch));
+		}
+		else if (ch == ' ' || ch == '\0')
+		{
+			if (!word.empty())
+			{
+				index.positions[word].push_back(index.nWords);
+				index.nWords++;
+				word.clear();
+			}
+			if (ch == '\0')
+				break;
+		}
+		// Other characters neither join nor end a word.
+	}
+}
+
+// Return true if some position p1 in pos1 has a position p2 in pos2 with
+// p2 != p1 and |p1 - p2| <= dist.  Like determineQuality, never use the
+// first word of the document (position 0) as p1.
+bool hasPairWithin(const vector<int>& pos1, const vector<int>& pos2, int dist)
+{
+	if (dist <= 0 || pos1.empty() || pos2.empty())
+		return false;
+
+	// If pos2 is much longer than pos1, binary search it for each p1;
+	// otherwise walk the two lists together.
+	bool useBinarySearch = pos1.size() * 16 < pos2.size();
+
+	vector<int>::const_iterator first = pos2.begin();
+	for (size_t i = 0; i < pos1.size(); i++)
+	{
+		long long p1 = pos1[i];
+		if (p1 == 0)
+			continue;
+		long long lowest = p1 - dist;
+
+		// Positions before lowest are too far from this p1, and since pos1
+		// is increasing, from every later one too.
+		if (useBinarySearch)
+			first = lower_bound(first, pos2.end(), lowest);
+		else
+			while (first != pos2.end() && *first < lowest)
+				++first;
+
+		vector<int>::const_iterator p2 = first;
+		if (p2 != pos2.end() && *p2 == p1)  // a word can't pair with itself
+			++p2;
+		if (p2 == pos2.end())
+			return false;
+		if (*p2 <= p1 + dist)
+			return true;
+	}
+	return false;
+}
+
+// Same result as determineQuality, but using an index of the document
+// built by indexDocument.
+int determineQualityIndexed(const int distance[],
+	const char word1[][MAX_WORD_LENGTH + 1],
+	const char word2[][MAX_WORD_LENGTH + 1],
+	int nRules,
+	const DocumentIndex& index)
+{
+	ALLOCATION_SCOPE("determineQualityIndexed");
+	int nMatches = 0;
+	for (int c = 0; c < nRules; c++)
+	{
+		unordered_map<string, vector<int>>::const_iterator it1 =
+			index.positions.find(word1[c]);
+		if (it1 == index.positions.end())
+			continue;
+		unordered_map<string, vector<int>>::const_iterator it2 =
+			index.positions.find(word2[c]);
+		if (it2 == index.positions.end())
+			continue;
+		if (hasPairWithin(it1->second, it2->second, distance[c]))
+			nMatches++;
+	}
+	return nMatches;
+}
+
+int determineQualityIndexed(const int distance[],
+	const char word1[][MAX_WORD_LENGTH + 1],
+	const char word2[][MAX_WORD_LENGTH + 1],
+	int nRules,
+	const char document[])
+{
+	ALLOCATION_SCOPE("determineQualityIndexed");
+	DocumentIndex index;
+	indexDocument(document, index);
+	return determineQualityIndexed(distance, word1, word2, nRules, index);
+}
+
+//*************************************
+//  Tokenizing documents
+//*************************************
+
+// Breaks a document into lowercase words a piece at a time, using the
+// same rules as determineQuality:  letters join words, blanks end them,
+// and other characters are skipped.  A word is handed to the caller as a
+// string_view into the tokenizer's own buffer, valid only during the
+// call.  As in determineQuality, a word longer than MAX_WORD_LENGTH is cut
+// off after MAX_WORD_LENGTH+1 letters, so it still can't match a rule.
+//
+// Where SSE2 or AVX2 is available, the text is handled 64 characters at a
+// time:  vector compares classify each character as a letter, a blank or
+// something else, giving one bit mask of each kind; letters are lowercased
+// by setting their 0x20 bit; and the words are then cut out of the block
+// using the masks, each run of letters being copied in one piece.
+class DocumentTokenizer
+{
+public:
+	DocumentTokenizer() : m_length(0) {}
+
+	// Process the next count characters of the document, calling
+	// onWord(string_view) for each word that they complete.
+	template <typename WordHandler>
+	void feed(const char text[], size_t count, WordHandler& onWord)
+	{
+		size_t k = 0;
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+		char lowered[BLOCK_SIZE + COPY_SIZE] = {};
+		for (; k + BLOCK_SIZE <= count; k += BLOCK_SIZE)
+		{
+			unsigned long long letters;
+			unsigned long long blanks;
+			classifyBlock(text + k, lowered, letters, blanks);
+			feedBlock(lowered, letters, blanks, onWord);
+		}
+#endif
+		feedScalar(text + k, count - k, onWord);
+	}
+
+	// Same as feed, one character at a time
+	template <typename WordHandler>
+	void feedScalar(const char text[], size_t count, WordHandler& onWord)
+	{
+		for (size_t k = 0; k < count; k++)
+		{
+			unsigned char ch = static_cast<unsigned char>(text[k]);
+			if (isalpha(ch))
+			{
+				if (m_length < MAX_WORD_LENGTH + 1)
+				{
+					m_word[m_length] = static_cast<char>(tolower(ch));
+					m_length++;
+				}
+			}
+			else if (ch == ' ' && m_length > 0)
+			{
+				onWord(string_view(m_word, m_length));
+				m_length = 0;
+			}
+		}
+	}
+
+	// The document is over; end the last word, if any.
+	template <typename WordHandler>
+	void finish(WordHandler& onWord)
+	{
+		if (m_length > 0)
+			onWord(string_view(m_word, m_length));
+		m_length = 0;
+	}
+
+private:
+	static const int BLOCK_SIZE = 64;
+
+	static int countTrailingZeros(unsigned long long bits)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctzll(bits);
+#endif
+	}
+
+	// Bits first through last-1
+	static unsigned long long bitRange(int first, int last)
+	{
+		unsigned long long below = (last == 64 ? ~0ULL : (1ULL << last) - 1);
+		return below & ~((1ULL << first) - 1);
+	}
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+	// Set bit k of letters (or blanks) if text[k] is a letter (or a blank),
+	// and store text[k], lowercased if it's a letter, in lowered[k].
+	static void classifyBlock(const char text[], char lowered[],
+		unsigned long long& letters, unsigned long long& blanks)
+	{
+		letters = 0;
+		blanks = 0;
+#ifdef __AVX2__
+		const __m256i caseBit = _mm256_set1_epi8(0x20);
+		const __m256i blank = _mm256_set1_epi8(' ');
+		// c|0x20 is a lowercase letter exactly when c is a letter; adding
+		// 128-'a' moves 'a' through 'z' to the 26 smallest signed bytes.
+		const __m256i shift = _mm256_set1_epi8(static_cast<char>(128 - 'a'));
+		const __m256i limit = _mm256_set1_epi8(static_cast<char>(-128 + 26));
+		for (int half = 0; half < 2; half++)
+		{
+			__m256i chars = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(text + 32 * half));
+			__m256i folded = _mm256_or_si256(chars, caseBit);
+			__m256i isLetter = _mm256_cmpgt_epi8(limit,
+				_mm256_add_epi8(folded, shift));
+			__m256i isBlank = _mm256_cmpeq_epi8(chars, blank);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(lowered + 32 * half),
+				_mm256_or_si256(chars, _mm256_and_si256(isLetter, caseBit)));
+			letters |= static_cast<unsigned long long>(static_cast<unsigned>(
+				_mm256_movemask_epi8(isLetter))) << (32 * half);
+			blanks |= static_cast<unsigned long long>(static_cast<unsigned>(
+				_mm256_movemask_epi8(isBlank))) << (32 * half);
+		}
+#else
+		const __m128i caseBit = _mm_set1_epi8(0x20);
+		const __m128i blank = _mm_set1_epi8(' ');
+		const __m128i shift = _mm_set1_epi8(static_cast<char>(128 - 'a'));
+		const __m128i limit = _mm_set1_epi8(static_cast<char>(-128 + 26));
+		for (int quarter = 0; quarter < 4; quarter++)
+		{
+			__m128i chars = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(text + 16 * quarter));
+			__m128i folded = _mm_or_si128(chars, caseBit);
+			__m128i isLetter = _mm_cmpgt_epi8(limit, _mm_add_epi8(folded, shift));
+			__m128i isBlank = _mm_cmpeq_epi8(chars, blank);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lowered + 16 * quarter),
+				_mm_or_si128(chars, _mm_and_si128(isLetter, caseBit)));
+			letters |= static_cast<unsigned long long>(
+				_mm_movemask_epi8(isLetter)) << (16 * quarter);
+			blanks |= static_cast<unsigned long long>(
+				_mm_movemask_epi8(isBlank)) << (16 * quarter);
+		}
+#endif
+	}
+#endif
+
+	// Cut the words out of a classified block of BLOCK_SIZE characters.
+	template <typename WordHandler>
+	void feedBlock(const char lowered[], unsigned long long letters,
+		unsigned long long blanks, WordHandler& onWord)
+	{
+		unsigned long long others = ~(letters | blanks);
+		int pos = 0;
+		while (pos < BLOCK_SIZE)
+		{
+			// The stretch up to the next blank, or the end of the block,
+			// belongs to the current word.
+			unsigned long long blanksAhead = blanks & bitRange(pos, BLOCK_SIZE);
+			int end = (blanksAhead == 0 ? BLOCK_SIZE : countTrailingZeros(blanksAhead));
+			if (end > pos)
+			{
+				// Copy each run of letters in the stretch, skipping the
+				// other characters between them.
+				unsigned long long stretch = bitRange(pos, end);
+				for (unsigned long long bits = letters & stretch; bits != 0; )
+				{
+					int runStart = countTrailingZeros(bits);
+					unsigned long long othersAhead = others & bitRange(runStart, end);
+					int runEnd = (othersAhead == 0 ? end : countTrailingZeros(othersAhead));
+					appendLetters(lowered + runStart, runEnd - runStart);
+					bits &= ~bitRange(runStart, runEnd);
+				}
+			}
+			if (end == BLOCK_SIZE)
+				break;
+			if (m_length > 0)
+			{
+				onWord(string_view(m_word, m_length));
+				m_length = 0;
+			}
+			pos = end + 1;
+		}
+	}
+
+	// letters must be followed by at least COPY_SIZE readable characters.
+	// Copying a fixed amount (and then keeping only count characters) lets
+	// the copy be a couple of vector moves rather than a library call.
+	void appendLetters(const char letters[], int count)
+	{
+		int room = MAX_WORD_LENGTH + 1 - m_length;
+		if (room <= 0)
+			return;
+		memcpy(m_word + m_length, letters, COPY_SIZE);
+		m_length += (count < room ? count : room);
+	}
+
+	static const int COPY_SIZE = 32;  // at least MAX_WORD_LENGTH + 1
+
+	char m_word[MAX_WORD_LENGTH + 1 + COPY_SIZE];
+	int  m_length;
+};
+
+//*************************************
+//  Compiled rule sets
+//*************************************
+
+// A standardized set of rules, preprocessed once so that many documents
+// can be scored against it.  Each distinct rule word gets a small integer
+// id, found through an open-addressing hash table, and for each word id
+// we keep the ids of the rules having that word as their first word and
+// as their second word.  Rule ids are positions in the original arrays.
+//
+// All of the tables live in one block of memory laid out exactly as the
+// rule set's file:  a header giving each table's offset from the start,
+// followed by the tables.  save writes the block out, and load maps a
+// file in, checks it in one pass and uses it where it lies, with no
+// parsing, so a process can start scoring with a large rule set almost at
+// once.
+class CompiledRuleSet
+{
+public:
+	static constexpr int NOT_A_RULE_WORD = -1;
+
+	// An empty rule set, for load
+	CompiledRuleSet();
+
+	CompiledRuleSet(const int distance[],
+		const char word1[][MAX_WORD_LENGTH + 1],
+		const char word2[][MAX_WORD_LENGTH + 1],
+		int nRules);
+
+	~CompiledRuleSet();
+
+	// Write the rule set to the named file, or map in a rule set written
+	// by save, returning true if successful.  If load fails, the rule set
+	// is left empty.
+	bool save(const char path[]) const;
+	bool load(const char path[]);
+
+	int ruleCount() const { return m_nRules; }
+	int wordCount() const { return m_nWords; }
+	int maxDistance() const { return m_maxDistance; }
+
+	// Return the id of a rule word, or NOT_A_RULE_WORD
+	int wordId(string_view word) const;
+	string_view word(int id) const;
+
+	int distance(int rule) const { return m_ruleDistance[rule]; }
+	int word1(int rule) const { return m_ruleWord1[rule]; }
+	int word2(int rule) const { return m_ruleWord2[rule]; }
+
+	// The rules having the word as their first (or second) word are
+	// rulesWithWord1(id)[0] through rulesWithWord1(id)[nRulesWithWord1(id)-1].
+	const int* rulesWithWord1(int id) const
+		{ return m_rulesByWord1 + m_firstByWord1[id]; }
+	int nRulesWithWord1(int id) const
+		{ return m_firstByWord1[id + 1] - m_firstByWord1[id]; }
+	const int* rulesWithWord2(int id) const
+		{ return m_rulesByWord2 + m_firstByWord2[id]; }
+	int nRulesWithWord2(int id) const
+		{ return m_firstByWord2[id + 1] - m_firstByWord2[id]; }
+
+private:
+	// The tables, in the order they're stored
+	enum Table
+	{
+		WORD_TEXT,       // the words, one after another
+		WORD_START,      // word id's text starts at WORD_TEXT[id]
+		SLOTS,           // hash table of word ids, NOT_A_RULE_WORD if empty
+		RULE_DISTANCE,
+		RULE_WORD1,
+		RULE_WORD2,
+		FIRST_BY_WORD1,  // see buildIndex
+		RULES_BY_WORD1,
+		FIRST_BY_WORD2,
+		RULES_BY_WORD2,
+		N_TABLES
+	};
+
+	// Bump FORMAT_VERSION whenever the layout changes.
+	static const uint32_t FORMAT_VERSION = 1;
+	static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+	struct Header
+	{
+		char     magic[8];         // "WFRULES"
+		uint32_t version;
+		uint32_t byteOrder;        // BYTE_ORDER_MARK, as the writer stored it
+		int32_t  nRules;
+		int32_t  nWords;
+		int32_t  nSlots;           // a power of 2
+		int32_t  maxDistance;
+		uint64_t size;             // of the whole block
+		uint64_t offset[N_TABLES]; // from the start of the block
+		uint64_t bytes[N_TABLES];
+	};
+
+	CompiledRuleSet(const CompiledRuleSet&) = delete;
+	CompiledRuleSet& operator=(const CompiledRuleSet&) = delete;
+
+	static unsigned long long hashWord(string_view word);
+	static int  addWord(vector<char>& text, vector<int>& start,
+		vector<int>& slots, string_view word);
+	static int  findWord(const char text[], const int start[],
+		const int slots[], size_t nSlots, string_view word);
+	static void growTable(const vector<char>& text, const vector<int>& start,
+		vector<int>& slots);
+	static void buildIndex(const vector<int>& ruleWord, int nWords,
+		vector<int>& first, vector<int>& rules);
+
+	void compile(const int distance[],
+		const char word1[][MAX_WORD_LENGTH + 1],
+		const char word2[][MAX_WORD_LENGTH + 1],
+		int nRules);
+	bool attach(const char block[], size_t size);
+	static bool hasValidTables(const Header& header, const int* const tables[]);
+	static bool isValidIndex(const int first[], const int rules[], int nWords,
+		int nRules);
+	void release();
+
+	vector<unsigned long long> m_block;    // the tables, unless mapped
+	void*       m_mapping;                 // the file, if mapped
+	size_t      m_mappingSize;
+
+	const Header* m_header;
+	int         m_nRules;
+	int         m_nWords;
+	size_t      m_nSlots;
+	int         m_maxDistance;
+	const char* m_wordText;
+	const int*  m_wordStart;
+	const int*  m_slots;
+	const int*  m_ruleDistance;
+	const int*  m_ruleWord1;
+	const int*  m_ruleWord2;
+	const int*  m_firstByWord1;
+	const int*  m_rulesByWord1;
+	const int*  m_firstByWord2;
+	const int*  m_rulesByWord2;
+};
+
+CompiledRuleSet::CompiledRuleSet()
+	: m_mapping(nullptr), m_mappingSize(0)
+{
+	compile(nullptr, nullptr, nullptr, 0);
+}
+
+CompiledRuleSet::CompiledRuleSet(const int distance[],
+	const char word1[][MAX_WORD_LENGTH + 1],
+	const char word2[][MAX_WORD_LENGTH + 1],
+	int nRules)
+	: m_mapping(nullptr), m_mappingSize(0)
+{
+	ALLOCATION_SCOPE("CompiledRuleSet::CompiledRuleSet");
+	compile(distance, word1, word2, nRules);
+}
+
+void CompiledRuleSet::compile(const int distance[],
+	const char word1[][MAX_WORD_LENGTH + 1],
+	const char word2[][MAX_WORD_LENGTH + 1],
+	int nRules)
+{
+	if (nRules < 0)
+		nRules = 0;
+
+	// Build the tables...
+	vector<char> text;
+	vector<vector<int>> tables(N_TABLES);
+	tables[WORD_START].push_back(0);
+	tables[SLOTS].assign(16, NOT_A_RULE_WORD);
+	int maxDistance = 0;
+	tables[RULE_DISTANCE].assign(distance, distance + nRules);
+	tables[RULE_WORD1].resize(nRules);
+	tables[RULE_WORD2].resize(nRules);
+	for (int c = 0; c < nRules; c++)
+	{
+		tables[RULE_WORD1][c] = addWord(text, tables[WORD_START], tables[SLOTS], word1[c]);
+		tables[RULE_WORD2][c] = addWord(text, tables[WORD_START], tables[SLOTS], word2[c]);
+		if (distance[c] > maxDistance)
+			maxDistance = distance[c];
+	}
+	int nWords = static_cast<int>(tables[WORD_START].size()) - 1;
+	buildIndex(tables[RULE_WORD1], nWords, tables[FIRST_BY_WORD1], tables[RULES_BY_WORD1]);
+	buildIndex(tables[RULE_WORD2], nWords, tables[FIRST_BY_WORD2], tables[RULES_BY_WORD2]);
+
+	// ...then lay them out in one block after the header, each starting
+	// on an 8-byte boundary.
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "WFRULES", 8);
+	header.version = FORMAT_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.nRules = nRules;
+	header.nWords = nWords;
+	header.nSlots = static_cast<int32_t>(tables[SLOTS].size());
+	header.maxDistance = maxDistance;
+	uint64_t size = sizeof(Header);
+	for (int t = 0; t < N_TABLES; t++)
+	{
+		header.offset[t] = size;
+		header.bytes[t] = (t == WORD_TEXT ? text.size() : tables[t].size() * sizeof(int));
+		size += (header.bytes[t] + 7) / 8 * 8;
+	}
+	header.size = size;
+
+	m_block.assign(size / 8, 0);
+	char* block = reinterpret_cast<char*>(m_block.data());
+	memcpy(block, &header, sizeof(header));
+	for (int t = 0; t < N_TABLES; t++)
+	{
+		if (header.bytes[t] > 0)
+			memcpy(block + header.offset[t],
+				t == WORD_TEXT ? static_cast<const void*>(text.data()) : tables[t].data(),
+				header.bytes[t]);
+	}
+	attach(block, size);
+}
+
+CompiledRuleSet::~CompiledRuleSet()
+{
+	release();
+}
+
+void CompiledRuleSet::release()
+{
+	if (m_mapping != nullptr)
+	{
+#ifdef _MSC_VER
+		delete[] static_cast<unsigned long long*>(m_mapping);
+#else
+		munmap(m_mapping, m_mappingSize);
+#endif
+		m_mapping = nullptr;
+		m_mappingSize = 0;
+	}
+}
+
+// Point the table pointers into a block laid out by the constructor,
+// returning false if it isn't one.
+bool CompiledRuleSet::attach(const char block[], size_t size)
+{
+	if (size < sizeof(Header))
+		return false;
+	const Header* header = reinterpret_cast<const Header*>(block);
+	if (memcmp(header->magic, "WFRULES", 8) != 0 ||
+			header->version != FORMAT_VERSION ||
+			header->byteOrder != BYTE_ORDER_MARK || header->size != size ||
+			header->nRules < 0 || header->nWords < 0 || header->nSlots <= header->nWords ||
+			(header->nSlots & (header->nSlots - 1)) != 0)
+		return false;
+
+	// Each table must lie within the block and be the size the counts say.
+	uint64_t expected[N_TABLES] = { 0,
+		header->nWords + 1ULL, static_cast<uint64_t>(header->nSlots),
+		static_cast<uint64_t>(header->nRules), static_cast<uint64_t>(header->nRules),
+		static_cast<uint64_t>(header->nRules),
+		header->nWords + 1ULL, static_cast<uint64_t>(header->nRules),
+		header->nWords + 1ULL, static_cast<uint64_t>(header->nRules) };
+	for (int t = 0; t < N_TABLES; t++)
+	{
+		if (header->offset[t] % 8 != 0 || header->offset[t] > size ||
+				header->bytes[t] > size - header->offset[t] ||
+				(t != WORD_TEXT && header->bytes[t] != expected[t] * sizeof(int)))
+			return false;
+	}
+	const int* tables[N_TABLES];
+	for (int t = 0; t < N_TABLES; t++)
+		tables[t] = reinterpret_cast<const int*>(block + header->offset[t]);
+	if (!hasValidTables(*header, tables))
+		return false;
+
+	m_header = header;
+	m_nRules = header->nRules;
+	m_nWords = header->nWords;
+	m_nSlots = header->nSlots;
+	m_maxDistance = header->maxDistance;
+	m_wordText = block + header->offset[WORD_TEXT];
+	m_wordStart = tables[WORD_START];
+	m_slots = tables[SLOTS];
+	m_ruleDistance = tables[RULE_DISTANCE];
+	m_ruleWord1 = tables[RULE_WORD1];
+	m_ruleWord2 = tables[RULE_WORD2];
+	m_firstByWord1 = tables[FIRST_BY_WORD1];
+	m_rulesByWord1 = tables[RULES_BY_WORD1];
+	m_firstByWord2 = tables[FIRST_BY_WORD2];
+	m_rulesByWord2 = tables[RULES_BY_WORD2];
+	return true;
+}
+
+// Whether the tables of a block hold what the constructor would have put
+// there, as far as scoring depends on it:  every word id and rule id in
+// range, the word text and rule groups in order, and an empty slot to end
+// each probe of the hash table.  A damaged file that passed the size
+// checks could otherwise send a lookup outside the block, or round the
+// hash table forever.
+bool CompiledRuleSet::hasValidTables(const Header& header, const int* const tables[])
+{
+	int nWords = header.nWords;
+	int nRules = header.nRules;
+
+	const int* wordStart = tables[WORD_START];
+	if (wordStart[0] != 0 ||
+			static_cast<uint64_t>(wordStart[nWords]) != header.bytes[WORD_TEXT])
+		return false;
+	for (int id = 0; id < nWords; id++)
+	{
+		if (wordStart[id + 1] < wordStart[id])
+			return false;
+	}
+
+	const int* slots = tables[SLOTS];
+	bool hasEmptySlot = false;
+	for (int k = 0; k < header.nSlots; k++)
+	{
+		if (slots[k] == NOT_A_RULE_WORD)
+			hasEmptySlot = true;
+		else if (slots[k] < 0 || slots[k] >= nWords)
+			return false;
+	}
+	if (!hasEmptySlot)
+		return false;
+
+	for (int r = 0; r < nRules; r++)
+	{
+		int distance = tables[RULE_DISTANCE][r];
+		int w1 = tables[RULE_WORD1][r];
+		int w2 = tables[RULE_WORD2][r];
+		if (distance < 1 || distance > header.maxDistance ||
+				w1 < 0 || w1 >= nWords || w2 < 0 || w2 >= nWords)
+			return false;
+	}
+
+	return isValidIndex(tables[FIRST_BY_WORD1], tables[RULES_BY_WORD1], nWords, nRules) &&
+		isValidIndex(tables[FIRST_BY_WORD2], tables[RULES_BY_WORD2], nWords, nRules);
+}
+
+// Whether first and rules make a grouping of rule ids like buildIndex's
+bool CompiledRuleSet::isValidIndex(const int first[], const int rules[], int nWords,
+	int nRules)
+{
+	if (first[0] != 0 || first[nWords] != nRules)
+		return false;
+	for (int id = 0; id < nWords; id++)
+	{
+		if (first[id + 1] < first[id])
+			return false;
+	}
+	for (int k = 0; k < nRules; k++)
+	{
+		if (rules[k] < 0 || rules[k] >= nRules)
+			return false;
+	}
+	return true;
+}
+
+bool CompiledRuleSet::save(const char path[]) const
+{
+	ALLOCATION_SCOPE("CompiledRuleSet::save");
+	FILE* f = fopen(path, "wb");
+	if (f == nullptr)
+		return false;
+	bool ok = fwrite(m_header, 1, m_header->size, f) == m_header->size;
+	if (fclose(f) != 0)
+		ok = false;
+	return ok;
+}
+
+bool CompiledRuleSet::load(const char path[])
+{
+	ALLOCATION_SCOPE("CompiledRuleSet::load");
+	release();
+	m_block.clear();
+
+	bool ok = false;
+#ifdef _MSC_VER
+	FILE* f = fopen(path, "rb");
+	if (f != nullptr)
+	{
+		if (_fseeki64(f, 0, SEEK_END) == 0)
+		{
+			size_t size = static_cast<size_t>(_ftelli64(f));
+			rewind(f);
+			unsigned long long* buffer = new unsigned long long[(size + 7) / 8 + 1];
+			m_mapping = buffer;
+			m_mappingSize = size;
+			ok = fread(buffer, 1, size, f) == size &&
+				attach(reinterpret_cast<const char*>(buffer), size);
+		}
+		fclose(f);
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd >= 0)
+	{
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0)
+		{
+			size_t size = static_cast<size_t>(info.st_size);
+			void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED)
+			{
+				m_mapping = mapping;
+				m_mappingSize = size;
+				ok = attach(static_cast<const char*>(mapping), size);
+			}
+		}
+		close(fd);
+	}
+#endif
+	if (!ok)
+	{
+		// Leave an empty rule set
+		release();
+		compile(nullptr, nullptr, nullptr, 0);
+	}
+	return ok;
+}
+
+// FNV-1a
+unsigned long long CompiledRuleSet::hashWord(string_view word)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	for (size_t k = 0; k < word.size(); k++)
+	{
+		h ^= static_cast<unsigned char>(word[k]);
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+int CompiledRuleSet::findWord(const char text[], const int start[],
+	const int slots[], size_t nSlots, string_view word)
+{
+	size_t mask = nSlots - 1;
+	for (size_t slot = hashWord(word) & mask; ; slot = (slot + 1) & mask)
+	{
+		int id = slots[slot];
+		if (id == NOT_A_RULE_WORD ||
+				string_view(text + start[id], start[id + 1] - start[id]) == word)
+			return id;
+	}
+}
+
+int CompiledRuleSet::wordId(string_view word) const
+{
+	return findWord(m_wordText, m_wordStart, m_slots, m_nSlots, word);
+}
+
+string_view CompiledRuleSet::word(int id) const
+{
+	return string_view(m_wordText + m_wordStart[id],
+		m_wordStart[id + 1] - m_wordStart[id]);
+}
+
+int CompiledRuleSet::addWord(vector<char>& text, vector<int>& start,
+	vector<int>& slots, string_view word)
+{
+	int id = findWord(text.data(), start.data(), slots.data(), slots.size(), word);
+	if (id != NOT_A_RULE_WORD)
+		return id;
+	id = static_cast<int>(start.size()) - 1;
+	text.insert(text.end(), word.begin(), word.end());
+	start.push_back(static_cast<int>(text.size()));
+
+	// Keep the table at most half full
+	if (2 * start.size() > slots.size())
+		growTable(text, start, slots);
+	else
+	{
+		size_t mask = slots.size() - 1;
+		size_t slot = hashWord(word) & mask;
+		while (slots[slot] != NOT_A_RULE_WORD)
+			slot = (slot + 1) & mask;
+		slots[slot] = id;
+	}
+	return id;
+}
+
+void CompiledRuleSet::growTable(const vector<char>& text, const vector<int>& start,
+	vector<int>& slots)
+{
+	slots.assign(2 * slots.size(), NOT_A_RULE_WORD);
+	size_t mask = slots.size() - 1;
+	for (int id = 0; id + 1 < static_cast<int>(start.size()); id++)
+	{
+		string_view word(text.data() + start[id], start[id + 1] - start[id]);
+		size_t slot = hashWord(word) & mask;
+		while (slots[slot] != NOT_A_RULE_WORD)
+			slot = (slot + 1) & mask;
+		slots[slot] = id;
+	}
+}
+
+// Group the rule ids by word:  the rules whose word is id are
+// rules[first[id]] through rules[first[id+1]-1], in increasing order.
+void CompiledRuleSet::buildIndex(const vector<int>& ruleWord, int nWords,
+	vector<int>& first, vector<int>& rules)
+{
+	first.assign(nWords + 1, 0);
+	for (size_t r = 0; r < ruleWord.size(); r++)
+		first[ruleWord[r] + 1]++;
+	for (int id = 0; id < nWords; id++)
+		first[id + 1] += first[id];
+	rules.resize(ruleWord.size());
+	vector<int> next(first.begin(), first.end() - 1);
+	for (size_t r = 0; r < ruleWord.size(); r++)
+		rules[next[ruleWord[r]]++] = static_cast<int>(r);
+}
+
+//*************************************
+//  Matching rules in one pass
+//*************************************
+
+// Finds the rules that match a document in a single left-to-right pass
+// over its word ids.  For each rule word it remembers only the most recent
+// position at which that word occurred.  When a word arrives, each
+// not-yet-matched rule it belongs to is resolved by checking the most
+// recent occurrence of the rule's other word:  if any earlier occurrence
+// is within the distance, the most recent one is.  A pair whose second
+// word comes first is found when the first word arrives, so no lookahead
+// is needed.  The cost per document word is proportional to the number of
+// rules having that word, with no scanning of windows.
+class RuleMatcher
+{
+public:
+	RuleMatcher(const CompiledRuleSet& rules);
+
+	// Start a new document.
+	void begin();
+
+	// Process the next word of the document, given as a rule word id (or
+	// CompiledRuleSet::NOT_A_RULE_WORD).
+	void addWord(int id);
+
+	// The number of rules that match the document so far
+	int matches() const { return m_nMatches; }
+
+	long long wordCount() const { return m_nDocWords; }
+
+private:
+	long long lastPosition(int id) const;
+	bool      isWithin(int rule, long long otherPos) const;
+	void      markMatched(int rule);
+
+	const CompiledRuleSet& m_rules;
+	vector<long long>      m_lastPos;     // where each word last occurred,
+	vector<unsigned>       m_lastPosIn;   //   valid if in this document
+	vector<unsigned>       m_matchedIn;   // the document a rule last matched
+	unsigned               m_document;    // number of the current document
+	long long              m_nDocWords;
+	int                    m_nMatches;
+};
+
+RuleMatcher::RuleMatcher(const CompiledRuleSet& rules)
+	: m_rules(rules), m_lastPos(rules.wordCount()),
+	m_lastPosIn(rules.wordCount(), 0), m_matchedIn(rules.ruleCount(), 0),
+	m_document(0), m_nDocWords(0), m_nMatches(0)
+{
+}
+
+void RuleMatcher::begin()
+{
+	// Rather than clear every word's position and rule's flag for each
+	// document, number the documents; an entry is valid only if it was
+	// marked with the current number.
+	m_document++;
+	if (m_document == 0)
+	{
+		fill(m_lastPosIn.begin(), m_lastPosIn.end(), 0);
+		fill(m_matchedIn.begin(), m_matchedIn.end(), 0);
+		m_document = 1;
+	}
+	m_nDocWords = 0;
+	m_nMatches = 0;
+}
+
+long long RuleMatcher::lastPosition(int id) const
+{
+	return m_lastPosIn[id] == m_document ? m_lastPos[id] : -1;
+}
+
+bool RuleMatcher::isWithin(int rule, long long otherPos) const
+{
+	return otherPos >= 0 && m_nDocWords - otherPos <= m_rules.distance(rule);
+}
+
+void RuleMatcher::markMatched(int rule)
+{
+	m_matchedIn[rule] = m_document;
+	m_nMatches++;
+}
+
+void RuleMatcher::addWord(int id)
+{
+	long long pos = m_nDocWords;
+	if (id != CompiledRuleSet::NOT_A_RULE_WORD)
+	{
+		// This word as the first word of a rule, with the second word
+		// earlier.  Like determineQuality, never start a match at the
+		// first word of the document.
+		if (pos > 0)
+		{
+			const int* rules = m_rules.rulesWithWord1(id);
+			int nRules = m_rules.nRulesWithWord1(id);
+			for (int k = 0; k < nRules; k++)
+			{
+				int r = rules[k];
+				if (m_matchedIn[r] != m_document &&
+						isWithin(r, lastPosition(m_rules.word2(r))))
+					markMatched(r);
+			}
+		}
+
+		// This word as the second word of a rule, with the first word
+		// earlier (but not at the first position).
+		const int* rules = m_rules.rulesWithWord2(id);
+		int nRules = m_rules.nRulesWithWord2(id);
+		for (int k = 0; k < nRules; k++)
+		{
+			int r = rules[k];
+			if (m_matchedIn[r] == m_document)
+				continue;
+			long long pos1 = lastPosition(m_rules.word1(r));
+			if (pos1 > 0 && isWithin(r, pos1))
+				markMatched(r);
+		}
+
+		m_lastPos[id] = pos;
+		m_lastPosIn[id] = m_document;
+	}
+	m_nDocWords++;
+}
+
+// Scores documents against a compiled rule set.  It keeps its working
+// storage from one document to the next, so a thread scoring many
+// documents should use one DocumentScorer for all of them.  A document
+// can be given all at once to score, or a piece at a time to begin,
+// feed and finish.
+class DocumentScorer
+{
+public:
+	DocumentScorer(const CompiledRuleSet& rules);
+
+	// Return the quality of the document, the same as determineQuality.
+	int score(const char document[], size_t length);
+
+	void begin();
+	void feed(const char text[], size_t count);
+	int  finish();
+
+	// Called by the tokenizer for each document word
+	void operator()(string_view word);
+
+private:
+	const CompiledRuleSet& m_rules;
+	DocumentTokenizer      m_tokenizer;
+	RuleMatcher            m_matcher;
+};
+
+DocumentScorer::DocumentScorer(const CompiledRuleSet& rules)
+	: m_rules(rules), m_matcher(rules)
+{
+}
+
+void DocumentScorer::operator()(string_view word)
+{
+	m_matcher.addWord(m_rules.wordId(word));
+}
+
+void DocumentScorer::begin()
+{
+	m_tokenizer = DocumentTokenizer();
+	m_matcher.begin();
+}
+
+void DocumentScorer::feed(const char text[], size_t count)
+{
+	m_tokenizer.feed(text, count, *this);
+}
+
+int DocumentScorer::finish()
+{
+	m_tokenizer.finish(*this);
+	return m_matcher.matches();
+}
+
+int DocumentScorer::score(const char document[], size_t length)
+{
+	ALLOCATION_SCOPE("DocumentScorer::score");
+	begin();
+	feed(document, length);
+	return finish();
+}
+
+// Return the quality of a document of the given length, which need not
+// be limited to MAX_DOCUMENT_LENGTH characters.
+int determineQualityOfText(const int distance[],
+	const char word1[][MAX_WORD_LENGTH + 1],
+	const char word2[][MAX_WORD_LENGTH + 1],
+	int nRules,
+	const char document[],
+	size_t length)
+{
+	ALLOCATION_SCOPE("determineQualityOfText");
+	CompiledRuleSet rules(distance, word1, word2, nRules);
+	return DocumentScorer(rules).score(document, length);
+}
+
+// Return the quality of the document in the named file, or -1 if the file
+// can't be read.  The file is mapped into memory (or, where that isn't
+// available, read) a piece at a time, so it can be many gigabytes long;
+// the memory needed depends only on the rules.
+int determineQualityOfFile(const int distance[],
+	const char word1[][MAX_WORD_LENGTH + 1],
+	const char word2[][MAX_WORD_LENGTH + 1],
+	int nRules,
+	const char path[])
+{
+	ALLOCATION_SCOPE("determineQualityOfFile");
+	CompiledRuleSet rules(distance, word1, word2, nRules);
+	DocumentScorer scorer(rules);
+	scorer.begin();
+	const size_t CHUNK_SIZE = 16 << 20;
+
+#ifdef _MSC_VER
+	FILE* f = fopen(path, "rb");
+	if (f == nullptr)
+		return -1;
+	vector<char> buffer(CHUNK_SIZE);
+	size_t count;
+	while ((count = fread(buffer.data(), 1, buffer.size(), f)) > 0)
+		scorer.feed(buffer.data(), count);
+	bool failed = ferror(f) != 0;
+	fclose(f);
+	if (failed)
+		return -1;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	size_t size = static_cast<size_t>(info.st_size);
+	if (size > 0)
+	{
+		void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED)
+		{
+			close(fd);
+			return -1;
+		}
+		madvise(mapping, size, MADV_SEQUENTIAL);
+		const char* text = static_cast<const char*>(mapping);
+		for (size_t offset = 0; offset < size; offset += CHUNK_SIZE)
+		{
+			size_t count = min(CHUNK_SIZE, size - offset);
+			scorer.feed(text + offset, count);
+
+			// We're done with these pages; let them go so that the memory
+			// we hold doesn't grow with the file.
+			madvise(const_cast<char*>(text) + offset, count, MADV_DONTNEED);
+		}
+		munmap(mapping, size);
+	}
+	close(fd);
+#endif
+	return scorer.finish();
+}
+
+//*************************************
+//  Corpora
+//*************************************
+
+// Score every document of a corpus against the rules, spreading the
+// documents over nThreads threads.  qualities[k] is set to the quality of
+// documents[k].
+void scoreCorpus(const CompiledRuleSet& rules, const vector<string>& documents,
+	int nThreads, vector<int>& qualities)
+{
+	ALLOCATION_SCOPE("scoreCorpus");
+	qualities.assign(documents.size(), 0);
+	if (nThreads < 1)
+		nThreads = 1;
+
+	// Threads repeatedly claim the next batch of documents; batching keeps
+	// them from contending for the counter on every short document.
+	const size_t BATCH_SIZE = 256;
+	atomic<size_t> nextDocument(0);
+	auto work = [&]() {
+		DocumentScorer scorer(rules);
+		for (;;)
+		{
+			size_t begin = nextDocument.fetch_add(BATCH_SIZE);
+			if (begin >= documents.size())
+				break;
+			size_t end = min(begin + BATCH_SIZE, documents.size());
+			for (size_t k = begin; k < end; k++)
+				qualities[k] = scorer.score(documents[k].data(), documents[k].size());
+		}
+	};
+
+	vector<thread> workers;
+	for (int t = 1; t < nThreads; t++)
+		workers.push_back(thread(work));
+	work();
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
+
+// Score the corpus and write one "documentId quality" line per document,
+// in document order.  Document ids are positions in the corpus.
+void scoreCorpus(const CompiledRuleSet& rules, const vector<string>& documents,
+	int nThreads, ostream& out)
+{
+	ALLOCATION_SCOPE("scoreCorpus");
+	vector<int> qualities;
+	scoreCorpus(rules, documents, nThreads, qualities);
+	string text;
+	for (size_t k = 0; k < qualities.size(); k++)
+	{
+		text += to_string(k);
+		text += ' ';
+		text += to_string(qualities[k]);
+		text += '\n';
+		if (text.size() >= (1 << 16))
+		{
+			out << text;
+			text.clear();
+		}
+	}
+	out << text;
+}
+
+//*************************************
+//  Incremental scoring
+//*************************************
+
+// Keeps the quality of a document up to date as words are appended,
+// inserted or erased, without rescoring the whole document.  For each
+// rule it counts the witnesses:  positions (other than the first) holding
+// the rule's first word with its second word within the distance.  A
+// rule matches when it has a witness.  An edit can change whether a
+// position is a witness only if the position is within maxDistance of the
+// edit, so only those positions are re-examined.  The document's word
+// ids are kept in blocks of at most MAX_BLOCK, found through a Fenwick
+// tree of the block sizes, so an edit costs time for the words it
+// changes, the words within maxDistance of it and a search logarithmic in
+// the document size, wherever in the document it is.
+class IncrementalScorer
+{
+public:
+	IncrementalScorer(const CompiledRuleSet& rules);
+
+	// Edits.  Positions count words from 0; text is broken into words as
+	// determineQuality does.
+	void append(const char text[], size_t length);
+	void insert(long long pos, const char text[], size_t length);
+	void erase(long long pos, long long count);
+
+	int quality() const { return m_quality; }
+	long long wordCount() const { return m_nWords; }
+
+	// Called by the tokenizer for each word of inserted text
+	void operator()(string_view word);
+
+private:
+	// A block that grows past MAX_BLOCK words is split into blocks at most
+	// half full, and one that shrinks below a quarter full is merged with
+	// the next if they fit in one.
+	static const size_t MAX_BLOCK = 4096;
+
+	void locate(long long pos, size_t& block, size_t& offset) const;
+	void addToIndex(size_t block, long long change);
+	void rebuildIndex();
+	void copyWords(long long first, long long last, vector<int>& ids) const;
+	void insertWords(long long pos, const vector<int>& ids);
+	void eraseWords(long long pos, long long count);
+	void replace(long long pos, long long nErase, const vector<int>& ids);
+	void countWitnesses(long long first, long long last, int change);
+	bool isWitness(long long pos1, int rule) const;
+
+	const CompiledRuleSet& m_rules;
+	DocumentTokenizer      m_tokenizer;
+	vector<int>            m_inserted;     // ids of the text being inserted
+	vector<vector<int>>    m_blocks;       // the word ids, in order
+	vector<long long>      m_blockIndex;   // Fenwick tree of block sizes
+	long long              m_nWords;
+	vector<int>            m_window;       // words from m_windowStart on,
+	long long              m_windowStart;  //   copied by countWitnesses
+	vector<long long>      m_witnesses;    // number of witnesses of each rule
+	int                    m_quality;
+};
+
+IncrementalScorer::IncrementalScorer(const CompiledRuleSet& rules)
+	: m_rules(rules), m_blockIndex(1, 0), m_nWords(0), m_windowStart(0),
+	m_witnesses(rules.ruleCount(), 0), m_quality(0)
+{
+}
+
+void IncrementalScorer::operator()(string_view word)
+{
+	m_inserted.push_back(m_rules.wordId(word));
+}
+
+void IncrementalScorer::append(const char text[], size_t length)
+{
+	ALLOCATION_SCOPE("IncrementalScorer::append");
+	insert(wordCount(), text, length);
+}
+
+void IncrementalScorer::insert(long long pos, const char text[], size_t length)
+{
+	ALLOCATION_SCOPE("IncrementalScorer::insert");
+	if (pos < 0 || pos > wordCount())
+		return;
+	m_inserted.clear();
+	m_tokenizer = DocumentTokenizer();
+	m_tokenizer.feed(text, length, *this);
+	m_tokenizer.finish(*this);
+	replace(pos, 0, m_inserted);
+}
+
+void IncrementalScorer::erase(long long pos, long long count)
+{
+	ALLOCATION_SCOPE("IncrementalScorer::erase");
+	if (pos < 0 || count <= 0 || pos >= wordCount())
+		return;
+	if (count > wordCount() - pos)
+		count = wordCount() - pos;
+	replace(pos, count, vector<int>());
+}
+
+// Find the block holding word position pos and the position's offset in
+// it.  The end of the document is the end of the last block.
+void IncrementalScorer::locate(long long pos, size_t& block, size_t& offset) const
+{
+	size_t nBlocks = m_blocks.size();
+	size_t step = 1;
+	while (2 * step <= nBlocks)
+		step *= 2;
+	size_t b = 0;
+	for (; step > 0; step /= 2)
+	{
+		if (b + step <= nBlocks && m_blockIndex[b + step] <= pos)
+		{
+			b += step;
+			pos -= m_blockIndex[b];
+		}
+	}
+	if (b == nBlocks)
+	{
+		block = nBlocks - 1;
+		offset = m_blocks[block].size();
+	}
+	else
+	{
+		block = b;
+		offset = static_cast<size_t>(pos);
+	}
+}
+
+void IncrementalScorer::addToIndex(size_t block, long long change)
+{
+	for (size_t i = block + 1; i < m_blockIndex.size(); i += i & (0 - i))
+		m_blockIndex[i] += change;
+}
+
+void IncrementalScorer::rebuildIndex()
+{
+	m_blockIndex.assign(m_blocks.size() + 1, 0);
+	for (size_t i = 1; i < m_blockIndex.size(); i++)
+	{
+		m_blockIndex[i] += m_blocks[i - 1].size();
+		size_t parent = i + (i & (0 - i));
+		if (parent < m_blockIndex.size())
+			m_blockIndex[parent] += m_blockIndex[i];
+	}
+}
+
+// Set ids to the words at positions first through last-1.
+void IncrementalScorer::copyWords(long long first, long long last, vector<int>& ids) const
+{
+	ids.clear();
+	if (first >= last)
+		return;
+	size_t b, offset;
+	locate(first, b, offset);
+	for (long long n = last - first; n > 0; b++, offset = 0)
+	{
+		const vector<int>& block = m_blocks[b];
+		size_t count = min(static_cast<size_t>(n), block.size() - offset);
+		ids.insert(ids.end(), block.begin() + offset, block.begin() + offset + count);
+		n -= count;
+	}
+}
+
+void IncrementalScorer::insertWords(long long pos, const vector<int>& ids)
+{
+	if (ids.empty())
+		return;
+	if (m_blocks.empty())
+	{
+		m_blocks.push_back(vector<int>());
+		rebuildIndex();
+	}
+	size_t b, offset;
+	locate(pos, b, offset);
+	vector<int>& block = m_blocks[b];
+	block.insert(block.begin() + offset, ids.begin(), ids.end());
+	m_nWords += ids.size();
+	if (block.size() <= MAX_BLOCK)
+	{
+		addToIndex(b, ids.size());
+		return;
+	}
+
+	// Split the block
+	vector<int> words;
+	words.swap(block);
+	size_t nPieces = (words.size() + MAX_BLOCK / 2 - 1) / (MAX_BLOCK / 2);
+	vector<vector<int>> pieces(nPieces);
+	for (size_t k = 0; k < nPieces; k++)
+		pieces[k].assign(words.begin() + k * words.size() / nPieces,
+			words.begin() + (k + 1) * words.size() / nPieces);
+	m_blocks.erase(m_blocks.begin() + b);
+	m_blocks.insert(m_blocks.begin() + b, make_move_iterator(pieces.begin()),
+		make_move_iterator(pieces.end()));
+	rebuildIndex();
+}
+
+void IncrementalScorer::eraseWords(long long pos, long long count)
+{
+	size_t first, offset;
+	locate(pos, first, offset);
+	m_nWords -= count;
+	size_t b = first;
+	bool emptied = false;
+	for (; count > 0; b++, offset = 0)
+	{
+		vector<int>& block = m_blocks[b];
+		size_t n = min(static_cast<size_t>(count), block.size() - offset);
+		block.erase(block.begin() + offset, block.begin() + offset + n);
+		addToIndex(b, -static_cast<long long>(n));
+		count -= n;
+		if (block.empty())
+			emptied = true;
+	}
+
+	// Drop the emptied blocks, and merge what is left of the first with
+	// the next if it's small and they fit in one.
+	bool merge = first + 1 < m_blocks.size() &&
+		!m_blocks[first].empty() && m_blocks[first].size() < MAX_BLOCK / 4;
+	if (!emptied && !merge)
+		return;
+	m_blocks.erase(remove_if(m_blocks.begin() + first, m_blocks.begin() + b,
+		[](const vector<int>& block) { return block.empty(); }), m_blocks.begin() + b);
+	if (merge && first + 1 < m_blocks.size() &&
+			m_blocks[first].size() + m_blocks[first + 1].size() <= MAX_BLOCK)
+	{
+		m_blocks[first].insert(m_blocks[first].end(), m_blocks[first + 1].begin(),
+			m_blocks[first + 1].end());
+		m_blocks.erase(m_blocks.begin() + first + 1);
+	}
+	rebuildIndex();
+}
+
+// Replace the nErase words starting at pos with the words ids.
+void IncrementalScorer::replace(long long pos, long long nErase, const vector<int>& ids)
+{
+	long long reach = m_rules.maxDistance();
+	long long first = max(0LL, pos - reach);
+
+	// Forget the witnesses near the words being replaced
+	countWitnesses(first, min(wordCount(), pos + nErase + reach), -1);
+
+	if (nErase > 0)
+		eraseWords(pos, nErase);
+	insertWords(pos, ids);
+
+	// Count the witnesses near the new words
+	countWitnesses(first, min(wordCount(), pos + static_cast<long long>(ids.size()) + reach), 1);
+}
+
+// Add change to the witness count of each rule for which a position from
+// first through last-1 is a witness.
+void IncrementalScorer::countWitnesses(long long first, long long last, int change)
+{
+	// Like determineQuality, never start a match at the first word.
+	if (first == 0)
+		first = 1;
+	if (first >= last)
+		return;
+
+	// The words a witness in the range can depend on
+	long long reach = m_rules.maxDistance();
+	m_windowStart = max(0LL, first - reach);
+	copyWords(m_windowStart, min(wordCount(), last + reach), m_window);
+
+	for (long long pos1 = first; pos1 < last; pos1++)
+	{
+		int id = m_window[pos1 - m_windowStart];
+		if (id == CompiledRuleSet::NOT_A_RULE_WORD)
+			continue;
+		const int* rules = m_rules.rulesWithWord1(id);
+		int nRules = m_rules.nRulesWithWord1(id);
+		for (int k = 0; k < nRules; k++)
+		{
+			int r = rules[k];
+			if (!isWitness(pos1, r))
+				continue;
+			long long before = m_witnesses[r];
+			m_witnesses[r] += change;
+			if (before == 0)
+				m_quality++;
+			else if (m_witnesses[r] == 0)
+				m_quality--;
+		}
+	}
+}
+
+// Whether pos1 is a witness of the rule, given the words copied into the
+// window by countWitnesses
+bool IncrementalScorer::isWitness(long long pos1, int rule) const
+{
+	long long dist = m_rules.distance(rule);
+	long long pos2 = max(0LL, pos1 - dist);
+	long long end = min(wordCount() - 1, pos1 + dist);
+	int word2 = m_rules.word2(rule);
+	for (; pos2 <= end; pos2++)
+		if (pos2 != pos1 && m_window[pos2 - m_windowStart] == word2)
+			return true;
+	return false;
+}
+
+//*************************************
+//  Ranking
+//*************************************
+
+// A document and its quality
+struct RankedDocument
+{
+	size_t document;
+	int    quality;
+};
+
+// How much work rankTopDocuments avoided
+struct RankingStats
+{
+	long long nDocuments = 0;
+	long long nPrunedByWordCount = 0;  // too few rules for the document's words
+	long long nPrunedByWordPairs = 0;  // too few rules with both words present
+	long long nScored = 0;             // matched in full
+};
+
+// Return the k documents of highest quality, best first, with ties going
+// to the earlier document -- exactly the first k of a full scan sorted
+// that way.  Each document's words are looked up once; then two upper
+// bounds on its quality, each costing less than matching, are compared
+// with the k-th best quality so far:  the number of rules whose first
+// word appears anywhere in the document, then the number of those whose
+// second word appears too.  A document that can't beat the k-th best is
+// never matched.
+vector<RankedDocument> rankTopDocuments(const CompiledRuleSet& rules,
+	const vector<string>& documents, int k, RankingStats* stats = nullptr)
+{
+	ALLOCATION_SCOPE("rankTopDocuments");
+	RankingStats counts;
+	vector<RankedDocument> best;  // a heap, worst of the best at the front
+	if (k <= 0)
+		return best;
+
+	// Whether rank a should come before rank b
+	auto isBetter = [](const RankedDocument& a, const RankedDocument& b) {
+		return a.quality > b.quality ||
+			(a.quality == b.quality && a.document < b.document);
+	};
+
+	// The words of the current document, and which rule words appear in it
+	// (as for RuleMatcher, marked with the document's number).
+	struct WordIds
+	{
+		const CompiledRuleSet& rules;
+		vector<int>& ids;
+		void operator()(string_view word) { ids.push_back(rules.wordId(word)); }
+	};
+	vector<int> ids;
+	vector<int> distinctIds;
+	vector<unsigned> presentIn(rules.wordCount(), 0);
+	DocumentTokenizer tokenizer;
+	RuleMatcher matcher(rules);
+
+	for (size_t d = 0; d < documents.size(); d++)
+	{
+		counts.nDocuments++;
+		ids.clear();
+		WordIds handler = { rules, ids };
+		tokenizer = DocumentTokenizer();
+		tokenizer.feed(documents[d].data(), documents[d].size(), handler);
+		tokenizer.finish(handler);
+
+		bool full = (static_cast<int>(best.size()) == k);
+		if (full)
+		{
+			// Documents are visited in order, so this one loses a tie.
+			int threshold = best.front().quality;
+			unsigned mark = static_cast<unsigned>(d + 1);
+
+			long long bound = 0;
+			distinctIds.clear();
+			for (size_t pos = 0; pos < ids.size(); pos++)
+			{
+				int id = ids[pos];
+				if (id == CompiledRuleSet::NOT_A_RULE_WORD || presentIn[id] == mark)
+					continue;
+				presentIn[id] = mark;
+				distinctIds.push_back(id);
+			}
+			for (size_t i = 0; i < distinctIds.size(); i++)
+				bound += rules.nRulesWithWord1(distinctIds[i]);
+			if (bound <= threshold)
+			{
+				counts.nPrunedByWordCount++;
+				continue;
+			}
+
+			bound = 0;
+			for (size_t i = 0; i < distinctIds.size() && bound <= threshold; i++)
+			{
+				const int* withWord1 = rules.rulesWithWord1(distinctIds[i]);
+				int n = rules.nRulesWithWord1(distinctIds[i]);
+				for (int j = 0; j < n; j++)
+					if (presentIn[rules.word2(withWord1[j])] == mark)
+						bound++;
+			}
+			if (bound <= threshold)
+			{
+				counts.nPrunedByWordPairs++;
+				continue;
+			}
+		}
+
+		counts.nScored++;
+		matcher.begin();
+		for (size_t pos = 0; pos < ids.size(); pos++)
+			matcher.addWord(ids[pos]);
+		RankedDocument ranked = { d, matcher.matches() };
+		if (!full)
+		{
+			best.push_back(ranked);
+			push_heap(best.begin(), best.end(), isBetter);
+		}
+		else if (isBetter(ranked, best.front()))
+		{
+			pop_heap(best.begin(), best.end(), isBetter);
+			best.back() = ranked;
+			push_heap(best.begin(), best.end(), isBetter);
+		}
+	}
+
+	sort(best.begin(), best.end(), isBetter);
+	if (stats != nullptr)
+		*stats = counts;
+	return best;
+}
+
+//*************************************
+//  Random rules and documents
+//*************************************
+
+// Inputs for the benchmark suite and the text server's load generator
+
+// Fill in nRules random rules over the words of vocab, with distances 1
+// through maxDistance.
+void makeRandomRules(mt19937& gen, const vector<string>& vocab, int nRules,
+	int maxDistance, vector<int>& distance,
+	vector<array<char, MAX_WORD_LENGTH + 1>>& word1,
+	vector<array<char, MAX_WORD_LENGTH + 1>>& word2)
+{
+	uniform_int_distribution<size_t> pickWord(0, vocab.size() - 1);
+	uniform_int_distribution<int> pickDistance(1, maxDistance);
+	distance.resize(nRules);
+	word1.resize(nRules);
+	word2.resize(nRules);
+	for (int c = 0; c < nRules; c++)
+	{
+		distance[c] = pickDistance(gen);
+		strcpy(word1[c].data(), vocab[pickWord(gen)].c_str());
+		strcpy(word2[c].data(), vocab[pickWord(gen)].c_str());
+	}
+}
+
+vector<string> makeRandomVocabulary(mt19937& gen, int nVocab)
+{
+	uniform_int_distribution<int> pickLength(1, 8);
+	uniform_int_distribution<int> pickLetter('a', 'z');
+	vector<string> vocab(nVocab);
+	for (int k = 0; k < nVocab; k++)
+	{
+		int len = pickLength(gen);
+		for (int i = 0; i < len; i++)
+			vocab[k] += static_cast<char>(pickLetter(gen));
+	}
+	return vocab;
+}
+
+string makeRandomDocument(mt19937& gen, const vector<string>& vocab, int nWords)
+{
+	uniform_int_distribution<size_t> pickWord(0, vocab.size() - 1);
+	string document;
+	for (int k = 0; k < nWords; k++)
+	{
+		if (k > 0)
+			document += ' ';
+		document += vocab[pickWord(gen)];
+	}
+	return document;
+}